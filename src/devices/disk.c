@@ -60,6 +60,9 @@ struct disk
 
     long long read_cnt;         /* Number of sectors read. */
     long long write_cnt;        /* Number of sectors written. */
+    disk_sector_t last_sector;  /* Sector of the last read or write. */
+    long long seek_dist;        /* Sum of sector distances between
+                                   consecutive reads and writes. */
   };
 
 /* An ATA channel (aka controller).
@@ -87,6 +90,7 @@ static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
 static void select_sector (struct disk *, disk_sector_t);
+static void count_seek (struct disk *, disk_sector_t);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -140,6 +144,8 @@ disk_init (void)
           d->capacity = 0;
 
           d->read_cnt = d->write_cnt = 0;
+          d->last_sector = 0;
+          d->seek_dist = 0;
         }
 
       /* Register interrupt handler. */
@@ -173,8 +179,8 @@ disk_print_stats (void)
         {
           struct disk *d = disk_get (chan_no, dev_no);
           if (d != NULL && d->is_ata) 
-            printf ("%s: %lld reads, %lld writes\n",
-                    d->name, d->read_cnt, d->write_cnt);
+            printf ("%s: %lld reads, %lld writes, %lld sectors seeked\n",
+                    d->name, d->read_cnt, d->write_cnt, d->seek_dist);
         }
     }
 }
@@ -233,6 +239,7 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer)
     PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
   input_sector (c, buffer);
   d->read_cnt++;
+  count_seek (d, sec_no);
   lock_release (&c->lock);
 }
 
@@ -258,6 +265,7 @@ disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer)
   output_sector (c, buffer);
   sema_down (&c->completion_wait);
   d->write_cnt++;
+  count_seek (d, sec_no);
   lock_release (&c->lock);
 }
 
@@ -445,6 +453,17 @@ select_sector (struct disk *d, disk_sector_t sec_no)
         DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
 }
 
+/* Adds the distance from the last sector accessed on disk D to
+   SEC_NO, which is being accessed now, to D's seek statistics. */
+static void
+count_seek (struct disk *d, disk_sector_t sec_no) 
+{
+  d->seek_dist += (sec_no > d->last_sector
+                   ? sec_no - d->last_sector
+                   : d->last_sector - sec_no);
+  d->last_sector = sec_no;
+}
+
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
@@ -0,0 +1,35 @@
+/* cachestat.c
+
+   Prints the kernel's buffer cache statistics. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+int
+main (void)
+{
+  struct cache_stat st;
+  int i;
+
+  cachestat (&st);
+  printf ("cache size:   %u sectors\n", st.size);
+  printf ("metadata:     %lld hits, %lld misses\n",
+          st.meta_hits, st.meta_misses);
+  printf ("data:         %lld hits, %lld misses\n",
+          st.data_hits, st.data_misses);
+  printf ("read-ahead:   %lld loaded, %lld used, %lld wasted\n",
+          st.read_aheads, st.read_ahead_hits, st.read_ahead_wasted);
+  printf ("evictions:    %lld, %lld dirty\n",
+          st.evictions, st.dirty_evictions);
+  printf ("write-backs:  %lld, %lld ticks dirty on average\n",
+          st.write_backs,
+          st.write_backs ? st.dirty_ticks / st.write_backs : 0);
+  printf ("batches:     ");
+  for (i = 0; i < CACHE_STAT_BATCHES; i++)
+    printf (" %lld", st.batches[i]);
+  printf ("\nregions:     ");
+  for (i = 0; i < CACHE_STAT_REGIONS; i++)
+    printf (" %lld", st.regions[i]);
+  printf ("\n");
+  return EXIT_SUCCESS;
+}
@@ -1,53 +1,225 @@
 #include "filesys/cache.h"
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "devices/timer.h"
 
+/* Cache line.
+
+   FLAGS, SECTOR_IDX and the list and hash elements are protected
+   by cache_lock.  BUFFER may only be touched under cache_lock
+   while FILESYS_CACHE_B is clear, or by the thread that set
+   FILESYS_CACHE_B, which owns it until it clears the flag again
+   and signals IO_DONE.  Holders of a cache_get() pointer may also
+   access BUFFER; a pinned line is neither evicted nor written back,
+   so it never becomes busy. */
 struct line {
   int flags;
   disk_sector_t sector_idx;
-  uint8_t buffer[DISK_SECTOR_SIZE];
+  struct hash_elem hash_elem;   /* Element in cache_index if present. */
+  struct list_elem list_elem;   /* Element in free_lines or policy queue. */
+  int queue;                    /* Policy queue holding the line. */
+  struct list_elem dirty_elem;  /* Element in dirty_lines if dirty. */
+  int pin_cnt;                  /* Number of cache_get() holders. */
+  int64_t dirty_since;          /* Tick at which the line got dirty. */
+  struct condition io_done;     /* Signaled when FILESYS_CACHE_B clears. */
+  uint8_t *buffer;              /* DISK_SECTOR_SIZE bytes in cache_pages. */
+};
+
+/* Replacement policy.
+   Every hook is called with cache_lock held. */
+struct cache_policy {
+  const char *name;
+  void (*init)(void);
+  void (*insert)(struct line *line);  /* LINE was bound to a sector. */
+  void (*touch)(struct line *line);   /* LINE was referenced. */
+  struct line *(*victim)(void);       /* Picks an idle line. */
+  void (*remove)(struct line *line);  /* LINE is about to be unbound. */
 };
 
-struct read_ahead_job {
+/* Sector recently evicted from the 2Q A1in queue. */
+struct ghost {
   disk_sector_t sector_idx;
-  struct list_elem elem;
+  struct hash_elem hash_elem;   /* Element in twoq_ghosts if in use. */
+  struct list_elem list_elem;   /* Element in twoq_a1out or free list. */
+};
+
+/* 2Q queues. */
+enum {
+  TWOQ_NONE,
+  TWOQ_A1IN,                    /* Referenced once, FIFO. */
+  TWOQ_AM                       /* Re-referenced, LRU. */
+};
+
+/* Ways of loading a line. */
+enum load_type {
+  LOAD_READ,                    /* Demand access, read on a miss. */
+  LOAD_OVERWRITE,               /* Demand access about to overwrite the
+                                   whole sector, no read needed. */
+  LOAD_READ_AHEAD               /* Speculative, not counted. */
 };
 
-static struct line *cache_load_line(disk_sector_t sector_idx);
+/* Maximum number of lines written back per batch.  cache_lock is
+   released between batches. */
+#define FLUSH_BATCH 16
+
+/* Maximum number of pending read-ahead requests. */
+#define READ_AHEAD_MAX 64
+
+static struct line *cache_load_line(disk_sector_t sector_idx,
+                                    enum load_type type,
+                                    bool *hitp);
+static void cache_count_access(disk_sector_t sector_idx,
+                               enum cache_access type,
+                               bool hit);
+static struct line *cache_evict_line(void);
+static void cache_mark_dirty(struct line *line);
+static void cache_mark_clean(struct line *line);
+static void cache_write_back(struct line *line);
+static void cache_flush_dirty(void);
+static void cache_wake_write_behind(void);
+static bool dirty_less(const struct list_elem *a_,
+                       const struct list_elem *b_,
+                       void *aux UNUSED);
+static void cache_end_io(struct line *line);
+static bool cache_line_idle(const struct line *line);
+static void cache_queue_read_ahead(disk_sector_t sector_idx);
+static struct line *cache_lookup(disk_sector_t sector_idx);
+static unsigned line_hash(const struct hash_elem *l_, void *aux UNUSED);
+static bool line_less(const struct hash_elem *a_,
+                      const struct hash_elem *b_,
+                      void *aux UNUSED);
 static void write_behind_thread(void *aux);
+static void flush_timer_thread(void *aux);
 static void read_ahead_thread(void *aux);
 
-static struct line cache[FILESYS_CACHE_MAX];
-static int cache_cursor;
+static void clock_init(void);
+static void clock_insert(struct line *line);
+static void clock_touch(struct line *line);
+static struct line *clock_victim(void);
+static void clock_remove(struct line *line);
+
+static void twoq_init(void);
+static void twoq_insert(struct line *line);
+static void twoq_touch(struct line *line);
+static struct line *twoq_victim(void);
+static void twoq_remove(struct line *line);
+static struct line *twoq_first_idle(struct list *queue);
+static struct ghost *twoq_ghost_lookup(disk_sector_t sector_idx);
+static unsigned ghost_hash(const struct hash_elem *g_, void *aux UNUSED);
+static bool ghost_less(const struct hash_elem *a_,
+                       const struct hash_elem *b_,
+                       void *aux UNUSED);
+
+static const struct cache_policy clock_policy = {
+  "clock", clock_init, clock_insert, clock_touch, clock_victim, clock_remove
+};
+
+static const struct cache_policy twoq_policy = {
+  "2q", twoq_init, twoq_insert, twoq_touch, twoq_victim, twoq_remove
+};
+
+static const struct cache_policy *policies[] = {&twoq_policy, &clock_policy};
+
+size_t cache_size;
+const char *cache_policy_name;
+int64_t cache_flush_interval = FILESYS_CACHE_FLUSH_INTERVAL;
+int cache_dirty_ratio = FILESYS_CACHE_DIRTY_RATIO;
+
+static struct line *cache;
+static void *cache_pages;
+static const struct cache_policy *cache_policy;
+static struct hash cache_index;
+static struct list free_lines;
 static struct lock cache_lock;
-static struct list read_ahead_queue;
+static struct condition cache_idle;   /* Signaled when any I/O ends. */
+static size_t busy_cnt;               /* Lines with FILESYS_CACHE_B set. */
+
+/* Dirty lines, protected by cache_lock. */
+static struct list dirty_lines;
+static size_t dirty_cnt;
+
+/* Wakes up the write-behind thread. */
+static struct semaphore write_behind_sema;
+static bool write_behind_pending;
+
+/* Pending read-ahead requests, a ring of READ_AHEAD_MAX sectors
+   protected by cache_lock.  READ_AHEAD_SEMA counts the entries. */
+static disk_sector_t read_ahead_ring[READ_AHEAD_MAX];
+static size_t read_ahead_head;
+static size_t read_ahead_cnt;
+static struct semaphore read_ahead_sema;
+
+/* Statistics, protected by cache_lock. */
+static struct cache_stat stats;
 
 void cache_init(void)
 {
+  size_t page_cnt;
+  size_t i;
+
+  cache_policy = policies[0];
+  if (cache_policy_name) {
+    for (i = 0; i < sizeof policies / sizeof *policies; i++)
+      if (!strcmp(cache_policy_name, policies[i]->name))
+        break;
+    if (i == sizeof policies / sizeof *policies)
+      PANIC("unknown cache policy `%s'", cache_policy_name);
+    cache_policy = policies[i];
+  }
+
+  if (cache_size == 0) {
+    cache_size = palloc_kernel_page_cnt() / FILESYS_CACHE_SHARE
+                 * (PGSIZE / DISK_SECTOR_SIZE);
+    if (cache_size < FILESYS_CACHE_MIN)
+      cache_size = FILESYS_CACHE_MIN;
+  }
+  page_cnt = DIV_ROUND_UP(cache_size * DISK_SECTOR_SIZE, PGSIZE);
+  cache_size = page_cnt * (PGSIZE / DISK_SECTOR_SIZE);
+  cache_pages = palloc_get_multiple(0, page_cnt);
+  cache = calloc(cache_size, sizeof *cache);
+  if (cache_pages == NULL || cache == NULL)
+    PANIC("can't allocate %zu sectors of buffer cache", cache_size);
+
+  hash_init(&cache_index, line_hash, line_less, NULL);
+  list_init(&free_lines);
+  for (i = 0; i < cache_size; i++) {
+    cache[i].buffer = (uint8_t *) cache_pages + i * DISK_SECTOR_SIZE;
+    cond_init(&cache[i].io_done);
+    list_push_back(&free_lines, &cache[i].list_elem);
+  }
+  cache_policy->init();
   lock_init(&cache_lock);
-  list_init(&read_ahead_queue);
-  thread_create("write_behind", PRI_MAX, write_behind_thread, NULL);
+  cond_init(&cache_idle);
+  list_init(&dirty_lines);
+  sema_init(&write_behind_sema, 0);
+  sema_init(&read_ahead_sema, 0);
+  thread_create("write_behind", PRI_DEFAULT, write_behind_thread, NULL);
+  if (cache_flush_interval > 0)
+    thread_create("flush_timer", PRI_MAX, flush_timer_thread, NULL);
   thread_create("read_ahead", PRI_DEFAULT, read_ahead_thread, NULL);
 }
 
 void cache_read(disk_sector_t sector_idx,
                 void *buffer,
                 int sector_ofs,
-                int chunk_size)
+                int chunk_size,
+                enum cache_access access)
 {
   ASSERT(sector_ofs + chunk_size <= DISK_SECTOR_SIZE);
 
   lock_acquire(&cache_lock);
-  struct line *line = cache_load_line(sector_idx);
-  if (sector_idx < disk_size(filesys_disk) - 1) {
-    struct read_ahead_job *job = malloc(sizeof(struct read_ahead_job));
-    job->sector_idx = sector_idx + 1;
-    list_push_front(&read_ahead_queue, &job->elem);
-  }
-  line->flags |= FILESYS_CACHE_A;
+  bool hit;
+  struct line *line = cache_load_line(sector_idx, LOAD_READ, &hit);
+  cache_count_access(sector_idx, access, hit);
+  cache_policy->touch(line);
   memcpy(buffer, &line->buffer[sector_ofs], chunk_size);
   lock_release(&cache_lock);
 }
@@ -55,100 +227,618 @@ void cache_read(disk_sector_t sector_idx,
 void cache_write(disk_sector_t sector_idx,
                  const void *buffer,
                  int sector_ofs,
-                 int chunk_size)
+                 int chunk_size,
+                 enum cache_access access)
 {
   ASSERT(sector_ofs + chunk_size <= DISK_SECTOR_SIZE);
 
   lock_acquire(&cache_lock);
-  struct line *line = cache_load_line(sector_idx);
-  if (sector_idx < disk_size(filesys_disk) - 1) {
-    struct read_ahead_job *job = malloc(sizeof(struct read_ahead_job));
-    job->sector_idx = sector_idx + 1;
-    list_push_front(&read_ahead_queue, &job->elem);
-  }
-  line->flags |= FILESYS_CACHE_A | FILESYS_CACHE_D;
+  bool overwrite = sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE;
+  bool hit;
+  struct line *line = cache_load_line(sector_idx,
+                                      overwrite ? LOAD_OVERWRITE : LOAD_READ,
+                                      &hit);
+  cache_count_access(sector_idx, access, hit);
+  cache_policy->touch(line);
+  cache_mark_dirty(line);
   memcpy(&line->buffer[sector_ofs], buffer, chunk_size);
   lock_release(&cache_lock);
 }
 
+/* Writes every dirty line back to disk.  Lines that another thread
+   already took off dirty_lines and is writing, in a write-behind
+   batch or a dirty eviction, are waited for, so that on return
+   everything written to the cache so far is on disk. */
 void cache_flush(void)
+{
+  lock_acquire(&cache_lock);
+  while (busy_cnt > 0)
+    cond_wait(&cache_idle, &cache_lock);
+  cache_flush_dirty();
+  lock_release(&cache_lock);
+}
+
+/* Returns a pointer to the DISK_SECTOR_SIZE bytes of SECTOR_IDX in
+   the cache, reading the sector if necessary.  The line stays
+   pinned in the cache until the pointer is returned with
+   cache_put(), so it can be read and modified in place.  Pins
+   should be held briefly: pinned lines cannot be evicted. */
+void *cache_get(disk_sector_t sector_idx)
 {
   struct line *line;
-  int i;
+  bool hit;
 
   lock_acquire(&cache_lock);
-  for (i = 0; i < FILESYS_CACHE_MAX; i++) {
-    line = &cache[i];
-    if (line->flags & FILESYS_CACHE_P && line->flags & FILESYS_CACHE_D) {
-      disk_write(filesys_disk, line->sector_idx, line->buffer);
-      line->flags &= ~FILESYS_CACHE_D;
-    }
-  }
+  line = cache_load_line(sector_idx, LOAD_READ, &hit);
+  cache_count_access(sector_idx, CACHE_META, hit);
+  cache_policy->touch(line);
+  line->pin_cnt++;
   lock_release(&cache_lock);
+  return line->buffer;
 }
 
-static struct line *cache_load_line(disk_sector_t sector_idx)
+/* Unpins the line holding BUFFER, a pointer obtained from
+   cache_get() or into the sector it points to.  DIRTY must be true
+   if the sector was modified. */
+void cache_put(const void *buffer, bool dirty)
 {
+  size_t idx = ((const uint8_t *) buffer - (const uint8_t *) cache_pages)
+               / DISK_SECTOR_SIZE;
   struct line *line;
+
+  ASSERT(idx < cache_size);
+  line = &cache[idx];
+
+  lock_acquire(&cache_lock);
+  ASSERT(line->pin_cnt > 0);
+  if (dirty)
+    cache_mark_dirty(line);
+  if (--line->pin_cnt == 0)
+    cond_broadcast(&cache_idle, &cache_lock);
+  lock_release(&cache_lock);
+}
+
+/* Asks the read-ahead thread to load SECTOR_IDX into the cache in
+   the background. */
+void cache_read_ahead(disk_sector_t sector_idx)
+{
+  lock_acquire(&cache_lock);
+  cache_queue_read_ahead(sector_idx);
+  lock_release(&cache_lock);
+}
+
+/* Copies the buffer cache statistics into *ST. */
+void cache_get_stats(struct cache_stat *st)
+{
+  lock_acquire(&cache_lock);
+  *st = stats;
+  st->size = cache_size;
+  lock_release(&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void cache_print_stats(void)
+{
+  struct cache_stat st;
   int i;
 
-  for (i = 0; i < FILESYS_CACHE_MAX; i++) {
-    line = &cache[cache_cursor];
-    if (++cache_cursor == FILESYS_CACHE_MAX)
-      cache_cursor = 0;
-    if (line->flags & FILESYS_CACHE_P && line->sector_idx == sector_idx)
-      return line;
-  }
+  cache_get_stats(&st);
+  printf("Cache: %u sectors (%s), %lld hits, %lld misses\n",
+         st.size, cache_policy->name,
+         st.meta_hits + st.data_hits, st.meta_misses + st.data_misses);
+  printf("Cache: metadata %lld hits, %lld misses; "
+         "data %lld hits, %lld misses\n",
+         st.meta_hits, st.meta_misses, st.data_hits, st.data_misses);
+  printf("Cache: %lld read-aheads, %lld used, %lld wasted\n",
+         st.read_aheads, st.read_ahead_hits, st.read_ahead_wasted);
+  printf("Cache: %lld evictions, %lld dirty; %lld write-backs, "
+         "%lld ticks dirty on average\n",
+         st.evictions, st.dirty_evictions, st.write_backs,
+         st.write_backs ? st.dirty_ticks / st.write_backs : 0);
+  printf("Cache: write-behind batches (1, 2-3, 4-7, 8-15, 16+):");
+  for (i = 0; i < CACHE_STAT_BATCHES; i++)
+    printf(" %lld", st.batches[i]);
+  printf("\nCache: accesses per 1/%d of disk:", CACHE_STAT_REGIONS);
+  for (i = 0; i < CACHE_STAT_REGIONS; i++)
+    printf(" %lld", st.regions[i]);
+  printf("\n");
+}
 
-  for (i = 0; i < FILESYS_CACHE_MAX; i++) {
-    line = &cache[cache_cursor];
-    if (++cache_cursor == FILESYS_CACHE_MAX)
-      cache_cursor = 0;
-    if (~line->flags & FILESYS_CACHE_P)
-      goto load;
-  }
+/* Returns the line holding SECTOR_IDX, reading it from disk if it
+   is not cached yet.  The returned line is valid and not busy.
+   With LOAD_OVERWRITE a missing sector is not read, and the
+   caller must fill the whole buffer before releasing cache_lock.
+   For demand loads, *HITP is set to whether the sector was already
+   cached; LOAD_READ_AHEAD ignores HITP.
+   Must be called with cache_lock held; the lock is released
+   while disk I/O is in progress, so other threads may use the
+   cache in the meantime. */
+static struct line *cache_load_line(disk_sector_t sector_idx,
+                                    enum load_type type,
+                                    bool *hitp)
+{
+  struct line *line;
+  bool hit = true;
 
   for (;;) {
-    line = &cache[cache_cursor];
-    if (++cache_cursor == FILESYS_CACHE_MAX)
-      cache_cursor = 0;
-    if (line->flags & FILESYS_CACHE_A)
-      line->flags &= ~FILESYS_CACHE_A;
-    else
+    if ((line = cache_lookup(sector_idx))) {
+      if (line->flags & FILESYS_CACHE_B) {
+        cond_wait(&line->io_done, &cache_lock);
+        continue;
+      }
+      if (type != LOAD_READ_AHEAD) {
+        if (line->flags & FILESYS_CACHE_R) {
+          line->flags &= ~FILESYS_CACHE_R;
+          stats.read_ahead_hits++;
+        }
+        *hitp = hit;
+      }
+      return line;
+    }
+
+    /* Eviction may drop cache_lock, in which case another thread
+       may have loaded SECTOR_IDX meanwhile, so look it up again. */
+    if ((line = cache_evict_line()))
       break;
+    hit = false;
   }
 
-  if (line->flags & FILESYS_CACHE_D)
-    disk_write(filesys_disk, line->sector_idx, line->buffer);
-
-load:
   line->flags = FILESYS_CACHE_P;
   line->sector_idx = sector_idx;
+  hash_insert(&cache_index, &line->hash_elem);
+  cache_policy->insert(line);
+  if (type == LOAD_OVERWRITE) {
+    line->flags |= FILESYS_CACHE_V;
+    *hitp = false;
+    return line;
+  }
+  if (type == LOAD_READ_AHEAD) {
+    line->flags |= FILESYS_CACHE_R;
+    stats.read_aheads++;
+  } else {
+    *hitp = false;
+  }
+
+  line->flags |= FILESYS_CACHE_B;
+  busy_cnt++;
+  lock_release(&cache_lock);
   disk_read(filesys_disk, sector_idx, line->buffer);
+  lock_acquire(&cache_lock);
+  line->flags |= FILESYS_CACHE_V;
+  cache_end_io(line);
   return line;
 }
 
+/* Counts a demand access of the given TYPE to SECTOR_IDX. */
+static void cache_count_access(disk_sector_t sector_idx,
+                               enum cache_access type,
+                               bool hit)
+{
+  if (type == CACHE_META) {
+    if (hit)
+      stats.meta_hits++;
+    else
+      stats.meta_misses++;
+  } else {
+    if (hit)
+      stats.data_hits++;
+    else
+      stats.data_misses++;
+  }
+  stats.regions[(uint64_t) sector_idx * CACHE_STAT_REGIONS
+                / disk_size(filesys_disk)]++;
+}
+
+/* Finds a line to reuse and unbinds it from its sector.
+   Returns a null pointer if cache_lock had to be released to write
+   a dirty victim back or to wait for busy lines, in which case
+   the caller should retry. */
+static struct line *cache_evict_line(void)
+{
+  struct line *line;
+
+  if (!list_empty(&free_lines))
+    return list_entry(list_pop_front(&free_lines), struct line, list_elem);
+
+  if ((line = cache_policy->victim()) == NULL) {
+    /* Every line is busy or pinned. */
+    cond_wait(&cache_idle, &cache_lock);
+    return NULL;
+  }
+  if (line->flags & FILESYS_CACHE_D) {
+    stats.dirty_evictions++;
+    cache_write_back(line);
+    return NULL;
+  }
+  stats.evictions++;
+  if (line->flags & FILESYS_CACHE_R)
+    stats.read_ahead_wasted++;
+  cache_policy->remove(line);
+  hash_delete(&cache_index, &line->hash_elem);
+  line->flags = 0;
+  return line;
+}
+
+/* Marks LINE dirty and, once more than cache_dirty_ratio percent
+   of the cache is dirty, wakes up the write-behind thread. */
+static void cache_mark_dirty(struct line *line)
+{
+  if (line->flags & FILESYS_CACHE_D)
+    return;
+  line->flags |= FILESYS_CACHE_D;
+  line->dirty_since = timer_ticks();
+  list_push_back(&dirty_lines, &line->dirty_elem);
+  if (++dirty_cnt * 100 > cache_size * cache_dirty_ratio)
+    cache_wake_write_behind();
+}
+
+/* Marks LINE, which must be dirty and not busy, clean and busy so
+   that its buffer can be written back without cache_lock. */
+static void cache_mark_clean(struct line *line)
+{
+  ASSERT(line->flags & FILESYS_CACHE_D);
+  ASSERT(~line->flags & FILESYS_CACHE_B);
+
+  line->flags = (line->flags | FILESYS_CACHE_B) & ~FILESYS_CACHE_D;
+  busy_cnt++;
+  list_remove(&line->dirty_elem);
+  dirty_cnt--;
+  stats.write_backs++;
+  stats.dirty_ticks += timer_ticks() - line->dirty_since;
+}
+
+/* Writes dirty LINE back to disk.
+   Releases cache_lock during the write. */
+static void cache_write_back(struct line *line)
+{
+  ASSERT(lock_held_by_current_thread(&cache_lock));
+
+  cache_mark_clean(line);
+  lock_release(&cache_lock);
+  disk_write(filesys_disk, line->sector_idx, line->buffer);
+  lock_acquire(&cache_lock);
+  cache_end_io(line);
+}
+
+/* Writes back every line that is dirty on entry, in ascending
+   sector order and in batches of FLUSH_BATCH.  cache_lock is
+   released while each batch is written, so foreground accesses
+   are only held up for one batch.  Lines dirtied in the meantime
+   go to the back of dirty_lines and wait for the next pass, as do
+   pinned lines. */
+static void cache_flush_dirty(void)
+{
+  struct line *batch[FLUSH_BATCH];
+  struct list_elem *e;
+  size_t left;
+  size_t cnt;
+  size_t i;
+
+  ASSERT(lock_held_by_current_thread(&cache_lock));
+
+  list_sort(&dirty_lines, dirty_less, NULL);
+  for (left = dirty_cnt; left > 0; left -= cnt) {
+    cnt = 0;
+    for (e = list_begin(&dirty_lines);
+         e != list_end(&dirty_lines) && cnt < FLUSH_BATCH && cnt < left;) {
+      struct line *line = list_entry(e, struct line, dirty_elem);
+      e = list_next(e);
+      if (line->pin_cnt == 0) {
+        cache_mark_clean(line);
+        batch[cnt++] = line;
+      }
+    }
+    if (cnt == 0)
+      break;
+    for (i = 0; i + 1 < CACHE_STAT_BATCHES && (2u << i) <= cnt; i++)
+      continue;
+    stats.batches[i]++;
+
+    lock_release(&cache_lock);
+    for (i = 0; i < cnt; i++)
+      disk_write(filesys_disk, batch[i]->sector_idx, batch[i]->buffer);
+    lock_acquire(&cache_lock);
+    for (i = 0; i < cnt; i++)
+      cache_end_io(batch[i]);
+  }
+}
+
+/* Wakes up the write-behind thread unless it is already due. */
+static void cache_wake_write_behind(void)
+{
+  if (!write_behind_pending) {
+    write_behind_pending = true;
+    sema_up(&write_behind_sema);
+  }
+}
+
+static bool dirty_less(const struct list_elem *a_,
+                       const struct list_elem *b_,
+                       void *aux UNUSED)
+{
+  struct line *a = list_entry(a_, struct line, dirty_elem);
+  struct line *b = list_entry(b_, struct line, dirty_elem);
+  return a->sector_idx < b->sector_idx;
+}
+
+/* Marks the I/O on LINE as finished and wakes up its waiters. */
+static void cache_end_io(struct line *line)
+{
+  line->flags &= ~FILESYS_CACHE_B;
+  busy_cnt--;
+  cond_broadcast(&line->io_done, &cache_lock);
+  cond_broadcast(&cache_idle, &cache_lock);
+}
+
+/* Queues SECTOR_IDX to be loaded by the read-ahead thread, unless
+   it is past the end of the disk, already cached or being loaded,
+   already queued, or the queue is full. */
+static void cache_queue_read_ahead(disk_sector_t sector_idx)
+{
+  size_t i;
+
+  if (sector_idx >= disk_size(filesys_disk) || cache_lookup(sector_idx))
+    return;
+  if (read_ahead_cnt == READ_AHEAD_MAX)
+    return;
+  for (i = 0; i < read_ahead_cnt; i++)
+    if (read_ahead_ring[(read_ahead_head + i) % READ_AHEAD_MAX] == sector_idx)
+      return;
+
+  read_ahead_ring[(read_ahead_head + read_ahead_cnt) % READ_AHEAD_MAX]
+    = sector_idx;
+  read_ahead_cnt++;
+  sema_up(&read_ahead_sema);
+}
+
+/* Returns true if LINE may be evicted: no I/O is in progress on it
+   and nobody holds it pinned. */
+static bool cache_line_idle(const struct line *line)
+{
+  return (~line->flags & FILESYS_CACHE_B) && line->pin_cnt == 0;
+}
+
+/* Returns the line holding SECTOR_IDX, or a null pointer if the
+   sector is not cached. */
+static struct line *cache_lookup(disk_sector_t sector_idx)
+{
+  struct line l;
+  struct hash_elem *e;
+
+  l.sector_idx = sector_idx;
+  e = hash_find(&cache_index, &l.hash_elem);
+  return e ? hash_entry(e, struct line, hash_elem) : NULL;
+}
+
+static unsigned line_hash(const struct hash_elem *l_, void *aux UNUSED)
+{
+  struct line *l = hash_entry(l_, struct line, hash_elem);
+  return hash_int(l->sector_idx);
+}
+
+static bool line_less(const struct hash_elem *a_,
+                      const struct hash_elem *b_,
+                      void *aux UNUSED)
+{
+  struct line *a = hash_entry(a_, struct line, hash_elem);
+  struct line *b = hash_entry(b_, struct line, hash_elem);
+  return a->sector_idx < b->sector_idx;
+}
+
+/* Clock replacement: a single accessed bit per line and a hand
+   sweeping the line array. */
+
+static size_t clock_hand;
+
+static void clock_init(void)
+{
+  clock_hand = 0;
+}
+
+static void clock_insert(struct line *line UNUSED)
+{
+}
+
+static void clock_touch(struct line *line)
+{
+  line->flags |= FILESYS_CACHE_A;
+}
+
+static struct line *clock_victim(void)
+{
+  struct line *line;
+  size_t i;
+
+  for (i = 0; i < 2 * cache_size; i++) {
+    line = &cache[clock_hand];
+    if (++clock_hand == cache_size)
+      clock_hand = 0;
+    if (!cache_line_idle(line))
+      continue;
+    if (line->flags & FILESYS_CACHE_A) {
+      line->flags &= ~FILESYS_CACHE_A;
+      continue;
+    }
+    return line;
+  }
+  return NULL;
+}
+
+static void clock_remove(struct line *line UNUSED)
+{
+}
+
+/* 2Q replacement (Johnson and Shasha, VLDB '94).
+
+   Newly loaded sectors enter the A1in FIFO and are not promoted
+   by further references while they stay there, so a one-shot
+   sequential scan only churns A1in.  A sector evicted from A1in
+   is remembered in the A1out ghost queue; if it is loaded again
+   while still remembered it has proven to be re-referenced and
+   goes to the Am LRU queue, which A1in cannot flush. */
+
+static struct list twoq_a1in;
+static struct list twoq_am;
+static struct list twoq_a1out;
+static struct list twoq_ghost_free;
+static struct hash twoq_ghosts;
+static size_t twoq_a1in_cnt;
+static size_t twoq_kin;         /* Target A1in size. */
+
+static void twoq_init(void)
+{
+  size_t kout = cache_size / 2;
+  struct ghost *ghosts;
+  size_t i;
+
+  list_init(&twoq_a1in);
+  list_init(&twoq_am);
+  list_init(&twoq_a1out);
+  list_init(&twoq_ghost_free);
+  hash_init(&twoq_ghosts, ghost_hash, ghost_less, NULL);
+  twoq_a1in_cnt = 0;
+  twoq_kin = cache_size / 4;
+
+  ghosts = calloc(kout, sizeof *ghosts);
+  if (ghosts == NULL)
+    PANIC("can't allocate 2Q ghost queue");
+  for (i = 0; i < kout; i++)
+    list_push_back(&twoq_ghost_free, &ghosts[i].list_elem);
+}
+
+static void twoq_insert(struct line *line)
+{
+  struct ghost *g = twoq_ghost_lookup(line->sector_idx);
+
+  if (g) {
+    hash_delete(&twoq_ghosts, &g->hash_elem);
+    list_remove(&g->list_elem);
+    list_push_back(&twoq_ghost_free, &g->list_elem);
+    line->queue = TWOQ_AM;
+    list_push_back(&twoq_am, &line->list_elem);
+  } else {
+    line->queue = TWOQ_A1IN;
+    list_push_back(&twoq_a1in, &line->list_elem);
+    twoq_a1in_cnt++;
+  }
+}
+
+static void twoq_touch(struct line *line)
+{
+  if (line->queue == TWOQ_AM) {
+    list_remove(&line->list_elem);
+    list_push_back(&twoq_am, &line->list_elem);
+  }
+}
+
+static struct line *twoq_victim(void)
+{
+  struct line *line;
+
+  if (twoq_a1in_cnt > twoq_kin && (line = twoq_first_idle(&twoq_a1in)))
+    return line;
+  if ((line = twoq_first_idle(&twoq_am)))
+    return line;
+  return twoq_first_idle(&twoq_a1in);
+}
+
+static void twoq_remove(struct line *line)
+{
+  list_remove(&line->list_elem);
+  if (line->queue == TWOQ_A1IN) {
+    struct ghost *g;
+
+    twoq_a1in_cnt--;
+    if (!list_empty(&twoq_ghost_free)) {
+      g = list_entry(list_pop_front(&twoq_ghost_free), struct ghost, list_elem);
+    } else if (!list_empty(&twoq_a1out)) {
+      g = list_entry(list_pop_front(&twoq_a1out), struct ghost, list_elem);
+      hash_delete(&twoq_ghosts, &g->hash_elem);
+    } else {
+      g = NULL;
+    }
+    if (g) {
+      g->sector_idx = line->sector_idx;
+      hash_insert(&twoq_ghosts, &g->hash_elem);
+      list_push_back(&twoq_a1out, &g->list_elem);
+    }
+  }
+  line->queue = TWOQ_NONE;
+}
+
+/* Returns the oldest idle line in QUEUE, or a null pointer if there
+   is none. */
+static struct line *twoq_first_idle(struct list *queue)
+{
+  struct list_elem *e;
+
+  for (e = list_begin(queue); e != list_end(queue); e = list_next(e)) {
+    struct line *line = list_entry(e, struct line, list_elem);
+    if (cache_line_idle(line))
+      return line;
+  }
+  return NULL;
+}
+
+static struct ghost *twoq_ghost_lookup(disk_sector_t sector_idx)
+{
+  struct ghost g;
+  struct hash_elem *e;
+
+  g.sector_idx = sector_idx;
+  e = hash_find(&twoq_ghosts, &g.hash_elem);
+  return e ? hash_entry(e, struct ghost, hash_elem) : NULL;
+}
+
+static unsigned ghost_hash(const struct hash_elem *g_, void *aux UNUSED)
+{
+  struct ghost *g = hash_entry(g_, struct ghost, hash_elem);
+  return hash_int(g->sector_idx);
+}
+
+static bool ghost_less(const struct hash_elem *a_,
+                       const struct hash_elem *b_,
+                       void *aux UNUSED)
+{
+  struct ghost *a = hash_entry(a_, struct ghost, hash_elem);
+  struct ghost *b = hash_entry(b_, struct ghost, hash_elem);
+  return a->sector_idx < b->sector_idx;
+}
+
 static void write_behind_thread(void *aux UNUSED)
 {
   for (;;) {
-    timer_sleep(500);
-    cache_flush();
+    sema_down(&write_behind_sema);
+    lock_acquire(&cache_lock);
+    write_behind_pending = false;
+    cache_flush_dirty();
+    lock_release(&cache_lock);
+  }
+}
+
+static void flush_timer_thread(void *aux UNUSED)
+{
+  for (;;) {
+    timer_sleep(cache_flush_interval);
+    lock_acquire(&cache_lock);
+    cache_wake_write_behind();
+    lock_release(&cache_lock);
   }
 }
 
 static void read_ahead_thread(void *aux UNUSED)
 {
+  disk_sector_t sector_idx;
+
   for (;;) {
+    sema_down(&read_ahead_sema);
     lock_acquire(&cache_lock);
-    if (!list_empty(&read_ahead_queue)) {
-      struct list_elem *e = list_pop_back(&read_ahead_queue);
-      struct read_ahead_job *job = list_entry(e, struct read_ahead_job, elem);
-      cache_load_line(job->sector_idx);
-      lock_release(&cache_lock);
-      free(job);
-    } else {
-      lock_release(&cache_lock);
-      timer_sleep(1);
-    }
+    ASSERT(read_ahead_cnt > 0);
+    sector_idx = read_ahead_ring[read_ahead_head];
+    read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+    read_ahead_cnt--;
+    if (!cache_lookup(sector_idx))
+      cache_load_line(sector_idx, LOAD_READ_AHEAD, NULL);
+    lock_release(&cache_lock);
   }
 }
@@ -1,23 +1,68 @@
 #ifndef FILESYS_CACHE_H
 #define FILESYS_CACHE_H
 
+#include <cache-stat.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "devices/disk.h"
 
-#define FILESYS_CACHE_MAX 64
+/* Default cache size: 1/FILESYS_CACHE_SHARE of the kernel pool,
+   but never less than FILESYS_CACHE_MIN sectors. */
+#define FILESYS_CACHE_SHARE 8
+#define FILESYS_CACHE_MIN 64
 
-#define FILESYS_CACHE_P 1
-#define FILESYS_CACHE_A 2
-#define FILESYS_CACHE_D 4
+/* Default write-behind interval in timer ticks, and share of
+   dirty lines in percent that triggers write-behind early. */
+#define FILESYS_CACHE_FLUSH_INTERVAL 500
+#define FILESYS_CACHE_DIRTY_RATIO 25
+
+#define FILESYS_CACHE_P 1   /* Present: line is bound to a sector. */
+#define FILESYS_CACHE_A 2   /* Accessed. */
+#define FILESYS_CACHE_D 4   /* Dirty. */
+#define FILESYS_CACHE_V 8   /* Valid: buffer holds the sector's data. */
+#define FILESYS_CACHE_B 16  /* Busy: disk I/O in progress on buffer. */
+#define FILESYS_CACHE_R 32  /* Read ahead and not used on demand yet. */
+
+/* Number of sectors in the cache, set by -cache=COUNT.
+   Zero selects the default size. */
+extern size_t cache_size;
+
+/* Replacement policy ("2q" or "clock"), set by -cache-policy=NAME.
+   A null pointer selects 2Q. */
+extern const char *cache_policy_name;
+
+/* Write-behind tuning, set by -cache-flush=TICKS and
+   -cache-dirty=PERCENT.  A non-positive interval disables
+   periodic write-behind. */
+extern int64_t cache_flush_interval;
+extern int cache_dirty_ratio;
+
+/* Kinds of demand access, for statistics.  Metadata is inodes,
+   extent blocks, directories and the free map; data is the
+   contents of regular files.  cache_get() always counts as
+   metadata. */
+enum cache_access {
+  CACHE_META,
+  CACHE_DATA
+};
 
 void cache_init(void);
 void cache_read(disk_sector_t sector_idx,
                 void *buffer,
                 int sector_ofs,
-                int chunk_size);
+                int chunk_size,
+                enum cache_access access);
 void cache_write(disk_sector_t sector_idx,
                  const void *buffer,
                  int sector_ofs,
-                 int chunk_size);
+                 int chunk_size,
+                 enum cache_access access);
+void *cache_get(disk_sector_t sector_idx);
+void cache_put(const void *buffer, bool dirty);
+void cache_read_ahead(disk_sector_t sector_idx);
 void cache_flush(void);
+void cache_get_stats(struct cache_stat *st);
+void cache_print_stats(void);
 
 #endif /* filesys/cache.h */
@@ -1,10 +1,14 @@
 #include "filesys/directory.h"
+#include <hash.h>
+#include <round.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 
 /* A directory. */
@@ -23,14 +27,134 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Number of hash buckets at the start of every directory.  Each
+   bucket is one sector of the directory file.
+
+   Bucket 0 takes any name, so a small directory is a single
+   linear bucket, stored in its inode while it fits.  Once bucket 0
+   fills up, a name goes in the bucket its hash selects, or in an
+   overflow bucket chained to it once that bucket fills up in turn.
+   Lookups search bucket 0 and then the name's own chain.  Buckets
+   never written to are holes that take no space on disk. */
+#define DIR_BUCKETS 32
+
+/* Number of entries in a bucket. */
+#define BUCKET_ENTRIES \
+  ((DISK_SECTOR_SIZE - sizeof (uint32_t)) / sizeof (struct dir_entry))
+
+/* On-disk bucket, one sector of a directory file. */
+struct dir_bucket
+  {
+    struct dir_entry entries[BUCKET_ENTRIES]; /* Entries. */
+    uint32_t next;                      /* Next bucket's block, or 0. */
+  };
+
+/* A bucket pinned in the buffer cache. */
+struct bucket
+  {
+    struct inode *inode;                /* Directory's inode. */
+    const struct dir_bucket *data;      /* Pinned sector, or null. */
+    size_t entry_cnt;                   /* Entries within the file. */
+    uint32_t next;                      /* Next bucket's block, or 0. */
+  };
+
+/* A cached result of looking up NAME in the directory whose inode
+   is in sector PARENT: the file's inode sector, or none at all. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in dentry_lru. */
+    disk_sector_t parent;               /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    bool negative;                      /* NAME does not exist? */
+    disk_sector_t child;                /* File's inode sector. */
+  };
+
+/* Maximum number of cached lookups. */
+#define DENTRY_MAX 128
+
+/* Number of generation counters.  Directories share them by inode
+   sector modulo DENTRY_GENS. */
+#define DENTRY_GENS 64
+
+static struct hash dentries;            /* Cached lookups. */
+static struct list dentry_lru;          /* Least recently used first. */
+
+/* Advanced whenever a directory's entries change, so that a lookup
+   that scanned the directory meanwhile does not cache what it
+   found. */
+static unsigned dentry_gens[DENTRY_GENS];
+
+static struct lock dentry_lock;         /* Protects the above. */
+
 static struct dir *open_path_helper(const char *path_);
+static bool lookup_sector (const struct dir *, const char *name,
+                           disk_sector_t *sectorp);
+static void dentry_set (disk_sector_t parent, const char *name,
+                        bool negative, disk_sector_t child,
+                        const unsigned *gen);
+static void dentry_purge (disk_sector_t parent);
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&dentry_lru);
+  lock_init (&dentry_lock);
+}
+
+/* Pins the bucket at block BLOCK of directory INODE into B.
+   B->DATA is a null pointer if the bucket is a hole, in which case
+   all of its entries are free.  Otherwise INODE stays locked
+   until bucket_close(), so no other inode calls on it may be made
+   in between.
+   Returns false if BLOCK is past the end of the directory. */
+static bool
+bucket_open (struct inode *inode, uint32_t block, struct bucket *b)
+{
+  off_t ofs = block * DISK_SECTOR_SIZE;
+  off_t length = inode_length (inode);
+  size_t avail;
+
+  if (ofs >= length)
+    return false;
+  avail = length - ofs;
+  b->inode = inode;
+  b->data = inode_get_block (inode, ofs);
+  b->entry_cnt = avail / sizeof (struct dir_entry);
+  if (b->entry_cnt > BUCKET_ENTRIES)
+    b->entry_cnt = BUCKET_ENTRIES;
+  b->next = (b->data != NULL
+             && avail >= offsetof (struct dir_bucket, next) + sizeof b->next
+             ? b->data->next : 0);
+  return true;
+}
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Unpins bucket B. */
+static void
+bucket_close (struct bucket *b)
+{
+  if (b->data != NULL)
+    inode_put_block (b->inode, b->data);
+}
+
+/* Returns the byte offset of entry IDX in the bucket at BLOCK. */
+static off_t
+entry_ofs (uint32_t block, size_t idx)
+{
+  return block * DISK_SECTOR_SIZE + idx * sizeof (struct dir_entry);
+}
+
+/* Creates a directory in the given SECTOR.  Buckets are added as
+   entries are, so ENTRY_CNT need not be reserved up front.
+   Returns true if successful, false on failure. */
 bool
-dir_create (disk_sector_t sector, size_t entry_cnt) 
+dir_create (disk_sector_t sector, size_t entry_cnt UNUSED) 
 {
-  if (inode_create(sector, entry_cnt * sizeof(struct dir_entry))) {
+  if (inode_create(sector, 0)) {
     struct inode *inode = inode_open(sector);
     if (inode) {
       inode_set_type(inode, FILE_TYPE_DIR);
@@ -106,23 +230,88 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  uint32_t hash_block;
+  uint32_t block = 0;
+  bool found = false;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  hash_block = hash_string (name) % DIR_BUCKETS;
+  for (;;)
+    {
+      struct bucket b;
+      size_t i;
+
+      if (!bucket_open (dir->inode, block, &b))
+        break;
+      for (i = 0; b.data != NULL && i < b.entry_cnt; i++)
+        {
+          const struct dir_entry *e = &b.data->entries[i];
+          if (e->in_use && !strcmp (name, e->name)) 
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = entry_ofs (block, i);
+              found = true;
+              break;
+            }
+        }
+      bucket_close (&b);
+      if (found)
+        break;
+      if (block == 0 && hash_block != 0)
+        block = hash_block;
+      else if (b.next != 0)
+        block = b.next;
+      else
+        break;
+    }
+  return found;
+}
+
+/* Searches DIR for a file with the given NAME, consulting the
+   cache of earlier lookups first.
+   If successful, returns true and sets *SECTORP to the file's
+   inode sector if SECTORP is non-null; otherwise, returns false. */
+static bool
+lookup_sector (const struct dir *dir, const char *name,
+               disk_sector_t *sectorp)
+{
+  disk_sector_t parent = inode_get_inumber (dir->inode);
+  struct dentry key;
+  struct hash_elem *h;
+  struct dir_entry e;
+  unsigned gen = 0;
+  bool found;
+
+  if (strlen (name) <= NAME_MAX)
+    {
+      key.parent = parent;
+      strlcpy (key.name, name, sizeof key.name);
+      lock_acquire (&dentry_lock);
+      h = hash_find (&dentries, &key.hash_elem);
+      if (h != NULL)
+        {
+          struct dentry *d = hash_entry (h, struct dentry, hash_elem);
+          list_remove (&d->lru_elem);
+          list_push_back (&dentry_lru, &d->lru_elem);
+          found = !d->negative;
+          if (found && sectorp != NULL)
+            *sectorp = d->child;
+          lock_release (&dentry_lock);
+          return found;
+        }
+      gen = dentry_gens[parent % DENTRY_GENS];
+      lock_release (&dentry_lock);
+    }
+
+  found = lookup (dir, name, &e, NULL);
+  if (found && sectorp != NULL)
+    *sectorp = e.inode_sector;
+  dentry_set (parent, name, !found, found ? e.inode_sector : 0, &gen);
+  return found;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -133,13 +322,13 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  disk_sector_t sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  if (lookup_sector (dir, name, &sector))
+    *inode = inode_open (sector);
   else
     *inode = NULL;
 
@@ -156,6 +345,8 @@ bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) 
 {
   struct dir_entry e;
+  uint32_t hash_block;
+  uint32_t block;
   off_t ofs;
   bool success = false;
   
@@ -167,28 +358,80 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
     return false;
 
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (lookup_sector (dir, name, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* INODE_SECTOR may have held a directory that has since been
+     removed.  Forget lookups cached in it before the new file,
+     which mkdir turns into a directory, can be reached. */
+  dentry_purge (inode_sector);
 
-  /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
+
+  /* Set OFS to offset of a free slot in bucket 0, or else in
+     NAME's bucket or one of its overflow buckets. */
+  hash_block = hash_string (name) % DIR_BUCKETS;
+  block = 0;
+  for (;;)
+    {
+      struct bucket b;
+      size_t i;
+
+      /* A bucket past the end of the file is empty. */
+      if (!bucket_open (dir->inode, block, &b))
+        {
+          ofs = entry_ofs (block, 0);
+          break;
+        }
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (b.data == NULL || i >= b.entry_cnt || !b.data->entries[i].in_use)
+          break;
+      bucket_close (&b);
+      if (i < BUCKET_ENTRIES)
+        {
+          ofs = entry_ofs (block, i);
+          break;
+        }
+
+      if (block == 0 && hash_block != 0)
+        {
+          block = hash_block;
+          continue;
+        }
+      if (b.next == 0)
+        {
+          /* The whole chain is full.  Put a new bucket at the end
+             of the file, past the hash buckets, and link it in. */
+          uint32_t next = DIV_ROUND_UP (inode_length (dir->inode),
+                                        DISK_SECTOR_SIZE);
+          if (next < DIR_BUCKETS)
+            next = DIR_BUCKETS;
+          success = (inode_write_at (dir->inode, &e, sizeof e,
+                                     entry_ofs (next, 0)) == sizeof e
+                     && inode_write_at (dir->inode, &next, sizeof next,
+                                        block * DISK_SECTOR_SIZE
+                                        + offsetof (struct dir_bucket, next))
+                        == sizeof next);
+          goto done;
+        }
+      block = b.next;
+    }
+
+  /* Write slot. */
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+  /* Bucket 0 grows an entry at a time from the start of the file,
+     so a directory that fits in its inode must still be there. */
+  ASSERT (!success || block != 0
+          || inode_length (dir->inode) > INODE_INLINE_MAX
+          || inode_is_inline (dir->inode));
+
  done:
+  if (success)
+    dentry_set (inode_get_inumber (dir->inode), name, false, inode_sector,
+                NULL);
   return success;
 }
 
@@ -230,6 +473,9 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dentry_set (inode_get_inumber (dir->inode), name, true, 0, NULL);
+  if (inode_get_type (inode) == FILE_TYPE_DIR)
+    dentry_purge (e.inode_sector);
 
   /* Remove inode. */
   inode_remove (inode);
@@ -246,18 +492,28 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  bool found = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  /* Walk the buckets in file order, skipping holes. */
+  while (!found)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+      uint32_t block = dir->pos / DISK_SECTOR_SIZE;
+      size_t i = dir->pos % DISK_SECTOR_SIZE / sizeof (struct dir_entry);
+      struct bucket b;
+
+      if (!bucket_open (dir->inode, block, &b))
+        break;
+      for (; b.data != NULL && i < b.entry_cnt; i++)
+        if (b.data->entries[i].in_use)
+          {
+            strlcpy (name, b.data->entries[i].name, NAME_MAX + 1);
+            found = true;
+            break;
+          }
+      bucket_close (&b);
+      dir->pos = found ? entry_ofs (block, i + 1) : entry_ofs (block + 1, 0);
     }
-  return false;
+  return found;
 }
 
 bool dir_open_path(const char *path_, struct dir **dir, char *name)
@@ -323,9 +579,9 @@ static struct dir *open_path_helper(const char *path_)
       break;
     }
 
-    struct dir_entry e;
-    if (lookup(dir, token, &e, NULL)) {
-      struct inode *inode = inode_open(e.inode_sector);
+    disk_sector_t sector;
+    if (lookup_sector(dir, token, &sector)) {
+      struct inode *inode = inode_open(sector);
       if (inode && inode_get_type(inode) == FILE_TYPE_DIR) {
         dir_close(dir);
         dir = dir_open(inode);
@@ -341,3 +597,109 @@ static struct dir *open_path_helper(const char *path_)
   free(path);
   return dir;
 }
+
+/* Records that looking up NAME in the directory in sector PARENT
+   finds the inode in sector CHILD, or nothing if NEGATIVE.
+   If GEN is non-null, this is the result of a scan that started at
+   generation *GEN, and it is dropped if the directory has changed
+   since.  Otherwise the caller has just changed the directory on
+   disk, and the directory's generation is advanced.
+   Names too long to exist are not cached. */
+static void
+dentry_set (disk_sector_t parent, const char *name, bool negative,
+            disk_sector_t child, const unsigned *gen)
+{
+  unsigned *cur = &dentry_gens[parent % DENTRY_GENS];
+
+  struct dentry key;
+  struct dentry *d;
+  struct hash_elem *h;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+
+  lock_acquire (&dentry_lock);
+  if (gen == NULL)
+    ++*cur;
+  else if (*gen != *cur)
+    {
+      lock_release (&dentry_lock);
+      return;
+    }
+  h = hash_find (&dentries, &key.hash_elem);
+  if (h != NULL)
+    {
+      d = hash_entry (h, struct dentry, hash_elem);
+      list_remove (&d->lru_elem);
+    }
+  else if (hash_size (&dentries) >= DENTRY_MAX)
+    {
+      /* Reuse the least recently used entry. */
+      d = list_entry (list_pop_front (&dentry_lru), struct dentry, lru_elem);
+      hash_delete (&dentries, &d->hash_elem);
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  else
+    {
+      d = malloc (sizeof *d);
+      if (d == NULL)
+        {
+          lock_release (&dentry_lock);
+          return;
+        }
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->negative = negative;
+  d->child = child;
+  list_push_back (&dentry_lru, &d->lru_elem);
+  lock_release (&dentry_lock);
+}
+
+/* Forgets all cached lookups in the directory in sector PARENT. */
+static void
+dentry_purge (disk_sector_t parent)
+{
+  struct list_elem *e;
+
+  lock_acquire (&dentry_lock);
+  dentry_gens[parent % DENTRY_GENS]++;
+  for (e = list_begin (&dentry_lru); e != list_end (&dentry_lru);)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      e = list_next (e);
+      if (d->parent == parent)
+        {
+          list_remove (&d->lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+          free (d);
+        }
+    }
+  lock_release (&dentry_lock);
+}
+
+/* Hashes a cached lookup by directory and name. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+/* Orders cached lookups by directory and name. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
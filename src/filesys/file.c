@@ -1,9 +1,14 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/disk.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "threads/malloc.h"
 
+/* Sequential read-ahead window bounds, in sectors. */
+#define FILE_READ_AHEAD_MIN 2
+#define FILE_READ_AHEAD_MAX 32
+
 /* An open file. */
 struct file 
   {
@@ -12,8 +17,13 @@ struct file
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
     struct dir *dir;            /* Used for directories. */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of the region already prefetched. */
+    int ra_window;              /* Read-ahead window in sectors. */
   };
 
+static void file_read_ahead (struct file *, off_t pos, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -75,6 +85,7 @@ file_read (struct file *file, void *buffer, off_t size)
 {
   if (file->type == FILE_TYPE_REGULAR) {
     off_t bytes_read = inode_read_at(file->inode, buffer, size, file->pos);
+    file_read_ahead(file, file->pos, bytes_read);
     file->pos += bytes_read;
     return bytes_read;
   } else {
@@ -82,6 +93,44 @@ file_read (struct file *file, void *buffer, off_t size)
   }
 }
 
+/* Updates FILE's read-ahead state after SIZE bytes were read at
+   POS.  A read that starts where the previous one ended doubles
+   the window, up to FILE_READ_AHEAD_MAX sectors, and prefetches
+   the part of it not requested yet; any other read collapses the
+   window. */
+static void
+file_read_ahead (struct file *file, off_t pos, off_t size)
+{
+  if (size <= 0)
+    return;
+
+  if (pos == file->ra_next)
+    {
+      file->ra_window *= 2;
+      if (file->ra_window < FILE_READ_AHEAD_MIN)
+        file->ra_window = FILE_READ_AHEAD_MIN;
+      if (file->ra_window > FILE_READ_AHEAD_MAX)
+        file->ra_window = FILE_READ_AHEAD_MAX;
+    }
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  file->ra_next = pos + size;
+
+  if (file->ra_window > 0)
+    {
+      off_t start = file->ra_next > file->ra_end ? file->ra_next : file->ra_end;
+      off_t end = file->ra_next + file->ra_window * DISK_SECTOR_SIZE;
+      if (start < end)
+        {
+          inode_read_ahead (file->inode, end - start, start);
+          file->ra_end = end;
+        }
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -15,6 +15,7 @@
 struct disk *filesys_disk;
 
 static void do_format (void);
+static bool allocate_inode_sector (struct dir *, disk_sector_t *);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -26,6 +27,7 @@ filesys_init (bool format)
     PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
   inode_init ();
+  dir_init ();
   free_map_init ();
   cache_init();
 
@@ -44,6 +46,7 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  inode_done ();
   free_map_close ();
   cache_flush();
 }
@@ -66,7 +69,7 @@ filesys_create (const char *name, off_t initial_size)
 
   disk_sector_t inode_sector = 0;
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && allocate_inode_sector (dir, &inode_sector)
                   && inode_create (inode_sector, initial_size)
                   && dir_add(dir, file_name, inode_sector));
   if (!success && inode_sector != 0) 
@@ -144,3 +147,17 @@ do_format (void)
   free_map_close ();
   printf ("done.\n");
 }
+
+/* Allocates a sector for a new inode in DIR, near DIR's own
+   inode, and stores it in *SECTORP.  If the disk looks full, waits
+   for the sectors of removed inodes to be reclaimed and tries
+   again.  Returns false if the disk is full. */
+static bool
+allocate_inode_sector (struct dir *dir, disk_sector_t *sectorp)
+{
+  disk_sector_t hint = inode_get_inumber (dir_get_inode (dir));
+
+  return (free_map_allocate_near (1, hint, sectorp)
+          || (inode_reclaim_wait ()
+              && free_map_allocate_near (1, hint, sectorp)));
+}
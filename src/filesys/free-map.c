@@ -1,13 +1,97 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <random.h>
+#include <round.h>
+#include <stdio.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+/* Sectors of the free map file that differ from the in-memory
+   free map, one bit per DISK_SECTOR_SIZE bytes of FREE_MAP. */
+static struct bitmap *free_map_dirty;
+
+/* Where free_map_allocate() resumes searching, just past the
+   last run it handed out. */
+static disk_sector_t free_map_cursor;
+
+/* A run of free sectors.  Once the free map has been read, every
+   maximal run of free sectors has one, indexed by where it starts,
+   where it ends, by (LENGTH, START) and by position, so that
+   allocations need not scan the bitmap.  The last two indexes are
+   treaps: binary search trees, on (LENGTH, START) and on START
+   respectively, that are also heaps on PRIORITY, which keeps them
+   balanced with high probability.  In the treap by position each
+   run also records the longest run in its subtree, so that the
+   first run after a given sector that is long enough can be found
+   without visiting the shorter ones. */
+struct free_run
+  {
+    struct hash_elem start_elem;        /* Element in runs_by_start. */
+    struct hash_elem end_elem;          /* Element in runs_by_end. */
+    struct free_run *left, *right;      /* Children in runs_by_size. */
+    struct free_run *pos_left;          /* Children in runs_by_pos. */
+    struct free_run *pos_right;
+    size_t max_length;                  /* Longest run in this subtree
+                                           of runs_by_pos. */
+    unsigned long priority;             /* Random treap priority. */
+    disk_sector_t start;                /* First free sector. */
+    size_t length;                      /* Number of free sectors. */
+  };
+
+/* Bucket I of the fragmentation report counts the runs with 2**I
+   to 2**(I+1) - 1 sectors, except that the last one counts all
+   the longer runs too. */
+#define RUN_BUCKETS 16
+
+static struct hash runs_by_start;       /* Runs by START. */
+static struct hash runs_by_end;         /* Runs by START + LENGTH. */
+static struct free_run *runs_by_size;   /* Root of the treap by size. */
+static struct free_run *runs_by_pos;    /* Root of the treap by START. */
+
+/* Whether the runs above are in use.  They are built by
+   free_map_open(); until then, or if memory runs out, allocation
+   scans the bitmap instead. */
+static bool runs_ready;
+
+/* Protects FREE_MAP, FREE_MAP_DIRTY, FREE_MAP_CURSOR and the free
+   runs.  Not held while the free map file is written. */
+static struct lock free_map_lock;
+
+/* Serializes free_map_flush() against itself and against closing
+   the free map file. */
+static struct lock free_map_flush_lock;
+
+/* Free map bits per sector of the free map file. */
+#define BITS_PER_SECTOR (DISK_SECTOR_SIZE * 8)
+
+static void free_map_mark_dirty (disk_sector_t, size_t);
+static void free_map_flush (void);
+static void free_map_flush_thread (void *aux);
+
+static void runs_build (void);
+static void runs_drop (void);
+static struct free_run *run_find_start (disk_sector_t);
+static struct free_run *run_next_fit (struct free_run *, disk_sector_t,
+                                      size_t cnt);
+static struct free_run *run_best_fit (size_t cnt, disk_sector_t hint);
+static disk_sector_t run_take (struct free_run *, size_t cnt);
+static void run_add (disk_sector_t, size_t cnt);
+static void run_count (const struct free_run *, size_t counts[RUN_BUCKETS],
+                       size_t *free_cnt, size_t *largest);
+static hash_hash_func run_start_hash, run_end_hash;
+static hash_less_func run_start_less, run_end_less;
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -15,55 +99,239 @@ free_map_init (void)
   free_map = bitmap_create (disk_size (filesys_disk));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--disk is too large");
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                DISK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--disk is too large");
+  lock_init (&free_map_lock);
+  lock_init (&free_map_flush_lock);
+  hash_init (&runs_by_start, run_start_hash, run_start_less, NULL);
+  hash_init (&runs_by_end, run_end_hash, run_end_less, NULL);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  if (cache_flush_interval > 0)
+    thread_create ("free_map_flush", PRI_DEFAULT, free_map_flush_thread,
+                   NULL);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  Searches onward from where the last
+   allocation left off, as free_map_allocate_near() does from its
+   hint.
    Returns true if successful, false if all sectors were
    available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) 
 {
-  disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, free_map_cursor, sectorp);
+}
+
+/* Allocates CNT consecutive sectors from the free map, preferring
+   sectors at or just after HINT, and stores the first sector into
+   *SECTORP.
+   The first free run at or after HINT that is long enough is
+   used.  If there is none, the shortest run that fits is used, the
+   one nearest HINT among several of the same length.  Before the
+   free map has been read, the first fit at or after HINT is used,
+   wrapping around to the start of the disk.
+   Returns true if successful, false if all sectors were
+   available. */
+bool
+free_map_allocate_near (size_t cnt, disk_sector_t hint,
+                        disk_sector_t *sectorp) 
+{
+  disk_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  if (hint > bitmap_size (free_map))
+    hint = 0;
+  if (runs_ready && cnt > 0)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
+      struct free_run *run = run_next_fit (runs_by_pos, hint, cnt);
+      if (run == NULL)
+        run = run_best_fit (cnt, hint);
       sector = BITMAP_ERROR;
+      if (run != NULL)
+        {
+          sector = run_take (run, cnt);
+          ASSERT (bitmap_none (free_map, sector, cnt));
+          bitmap_set_multiple (free_map, sector, cnt, true);
+        }
+    }
+  else
+    {
+      sector = bitmap_scan_and_flip (free_map, hint, cnt, false);
+      if (sector == BITMAP_ERROR && hint > 0)
+        sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+    }
+  if (sector != BITMAP_ERROR)
+    {
+      free_map_mark_dirty (sector, cnt);
+      free_map_cursor = sector + cnt;
     }
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates up to CNT free sectors starting exactly at SECTOR,
+   stopping at the first one in use.
+   Returns the number of sectors allocated, possibly 0. */
+size_t
+free_map_extend (disk_sector_t sector, size_t cnt)
+{
+  size_t n = 0;
+
+  lock_acquire (&free_map_lock);
+  if (runs_ready)
+    {
+      struct free_run *run = run_find_start (sector);
+      if (run != NULL)
+        {
+          n = run->length < cnt ? run->length : cnt;
+          run_take (run, n);
+        }
+    }
+  else
+    while (n < cnt && sector + n < bitmap_size (free_map)
+           && !bitmap_test (free_map, sector + n))
+      n++;
+  if (n > 0)
+    {
+      bitmap_set_multiple (free_map, sector, n, true);
+      free_map_mark_dirty (sector, n);
+    }
+  lock_release (&free_map_lock);
+  return n;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_map_mark_dirty (sector, cnt);
+  if (runs_ready && cnt > 0)
+    run_add (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Prints how fragmented the free space is. */
+void
+free_map_print_stats (void) 
+{
+  size_t counts[RUN_BUCKETS] = {0};
+  size_t free_cnt = 0, largest = 0;
+  size_t run_cnt;
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (!runs_ready)
+    {
+      lock_release (&free_map_lock);
+      return;
+    }
+  run_count (runs_by_size, counts, &free_cnt, &largest);
+  run_cnt = hash_size (&runs_by_start);
+  printf ("Free map: %zu free sectors in %zu runs, largest %zu",
+          free_cnt, run_cnt, largest);
+  if (free_cnt > 0)
+    printf (" (%zu%% fragmented)", 100 - largest * 100 / free_cnt);
+  printf ("\n");
+  printf ("Free map: runs by length:");
+  for (i = 0; i < RUN_BUCKETS; i++)
+    if (counts[i] > 0)
+      printf (" %zu+:%zu", (size_t) 1 << i, counts[i]);
+  printf ("\n");
+  lock_release (&free_map_lock);
+}
+
+/* Notes that the free map file sectors holding the bits for CNT
+   sectors starting at SECTOR need to be written. */
+static void
+free_map_mark_dirty (disk_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  ASSERT (cnt > 0);
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+/* Writes the dirty sectors of the free map to the free map file.
+   They reach the disk with the rest of the buffer cache. */
+static void
+free_map_flush (void)
+{
+  size_t idx = 0;
+
+  lock_acquire (&free_map_flush_lock);
+  while (free_map_file != NULL)
+    {
+      off_t ofs;
+      off_t size;
+
+      /* A change made while the sector is being written marks it
+         dirty again, so it is picked up by the next flush. */
+      lock_acquire (&free_map_lock);
+      idx = bitmap_scan_and_flip (free_map_dirty, idx, 1, true);
+      lock_release (&free_map_lock);
+      if (idx == BITMAP_ERROR)
+        break;
+
+      ofs = idx * DISK_SECTOR_SIZE;
+      size = bitmap_file_size (free_map) - ofs;
+      if (size > DISK_SECTOR_SIZE)
+        size = DISK_SECTOR_SIZE;
+      if (!bitmap_write_at (free_map, free_map_file, ofs, size))
+        PANIC ("can't write free map");
+      idx++;
+    }
+  lock_release (&free_map_flush_lock);
+}
+
+/* Periodically writes out the free map, along with the buffer
+   cache's own periodic flush. */
+static void
+free_map_flush_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (cache_flush_interval);
+      free_map_flush ();
+    }
 }
 
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void) 
 {
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  struct file *file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
+  if (!bitmap_read (free_map, file))
     PANIC ("can't read free map");
+  lock_acquire (&free_map_lock);
+  runs_build ();
+  lock_release (&free_map_lock);
+  lock_acquire (&free_map_flush_lock);
+  free_map_file = file;
+  lock_release (&free_map_flush_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
+  lock_acquire (&free_map_flush_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_flush_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -71,14 +339,494 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  Sectors allocated to the file while it
+     is written stay dirty and go out with the next flush. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  lock_acquire (&free_map_flush_lock);
+  free_map_file = file;
+  lock_release (&free_map_flush_lock);
+}
+
+/* Free runs. */
+
+/* Returns the bucket for runs of LENGTH sectors. */
+static size_t
+run_bucket (size_t length) 
+{
+  size_t i = 0;
+
+  while ((length >>= 1) != 0 && i < RUN_BUCKETS - 1)
+    i++;
+  return i;
+}
+
+/* Adds the runs in the treap rooted at RUN to FREE_CNT, LARGEST
+   and the bucket counts in COUNTS. */
+static void
+run_count (const struct free_run *run, size_t counts[RUN_BUCKETS],
+           size_t *free_cnt, size_t *largest)
+{
+  if (run == NULL)
+    return;
+  counts[run_bucket (run->length)]++;
+  *free_cnt += run->length;
+  if (run->length > *largest)
+    *largest = run->length;
+  run_count (run->left, counts, free_cnt, largest);
+  run_count (run->right, counts, free_cnt, largest);
+}
+
+/* Returns true if run A orders before (LENGTH, START) in
+   runs_by_size. */
+static bool
+run_size_less (const struct free_run *a, size_t length, disk_sector_t start)
+{
+  return a->length < length || (a->length == length && a->start < start);
+}
+
+/* Splits the treap rooted at T into the runs ordered before
+   (LENGTH, START), in *L, and the rest, in *R. */
+static void
+treap_split (struct free_run *t, size_t length, disk_sector_t start,
+             struct free_run **l, struct free_run **r)
+{
+  if (t == NULL)
+    *l = *r = NULL;
+  else if (run_size_less (t, length, start))
+    {
+      treap_split (t->right, length, start, &t->right, r);
+      *l = t;
+    }
+  else
+    {
+      treap_split (t->left, length, start, l, &t->left);
+      *r = t;
+    }
+}
+
+/* Joins treaps A and B, all of whose runs order before B's, and
+   returns the root. */
+static struct free_run *
+treap_merge (struct free_run *a, struct free_run *b)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (a->priority > b->priority)
+    {
+      a->right = treap_merge (a->right, b);
+      return a;
+    }
+  b->left = treap_merge (a, b->left);
+  return b;
+}
+
+/* Inserts RUN into the treap rooted at T and returns the root. */
+static struct free_run *
+treap_insert (struct free_run *t, struct free_run *run)
+{
+  if (t == NULL)
+    return run;
+  if (run->priority > t->priority)
+    {
+      treap_split (t, run->length, run->start, &run->left, &run->right);
+      return run;
+    }
+  if (run_size_less (run, t->length, t->start))
+    t->left = treap_insert (t->left, run);
+  else
+    t->right = treap_insert (t->right, run);
+  return t;
+}
+
+/* Removes RUN from the treap rooted at T and returns the root. */
+static struct free_run *
+treap_remove (struct free_run *t, struct free_run *run)
+{
+  ASSERT (t != NULL);
+  if (t == run)
+    return treap_merge (t->left, t->right);
+  if (run_size_less (run, t->length, t->start))
+    t->left = treap_remove (t->left, run);
+  else
+    t->right = treap_remove (t->right, run);
+  return t;
+}
+
+/* Recomputes RUN's MAX_LENGTH from its own length and its
+   children's in runs_by_pos. */
+static void
+pos_update (struct free_run *run)
+{
+  run->max_length = run->length;
+  if (run->pos_left != NULL && run->pos_left->max_length > run->max_length)
+    run->max_length = run->pos_left->max_length;
+  if (run->pos_right != NULL && run->pos_right->max_length > run->max_length)
+    run->max_length = run->pos_right->max_length;
+}
+
+/* Splits the treap by position rooted at T into the runs that
+   start before START, in *L, and the rest, in *R. */
+static void
+pos_split (struct free_run *t, disk_sector_t start,
+           struct free_run **l, struct free_run **r)
+{
+  if (t == NULL)
+    *l = *r = NULL;
+  else if (t->start < start)
+    {
+      pos_split (t->pos_right, start, &t->pos_right, r);
+      pos_update (t);
+      *l = t;
+    }
+  else
+    {
+      pos_split (t->pos_left, start, l, &t->pos_left);
+      pos_update (t);
+      *r = t;
+    }
+}
+
+/* Joins treaps by position A and B, all of whose runs start before
+   B's, and returns the root. */
+static struct free_run *
+pos_merge (struct free_run *a, struct free_run *b)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (a->priority > b->priority)
+    {
+      a->pos_right = pos_merge (a->pos_right, b);
+      pos_update (a);
+      return a;
+    }
+  b->pos_left = pos_merge (a, b->pos_left);
+  pos_update (b);
+  return b;
+}
+
+/* Inserts RUN into the treap by position rooted at T and returns
+   the root. */
+static struct free_run *
+pos_insert (struct free_run *t, struct free_run *run)
+{
+  if (t == NULL)
+    {
+      pos_update (run);
+      return run;
+    }
+  if (run->priority > t->priority)
+    {
+      pos_split (t, run->start, &run->pos_left, &run->pos_right);
+      pos_update (run);
+      return run;
+    }
+  if (run->start < t->start)
+    t->pos_left = pos_insert (t->pos_left, run);
+  else
+    t->pos_right = pos_insert (t->pos_right, run);
+  pos_update (t);
+  return t;
+}
+
+/* Removes RUN from the treap by position rooted at T and returns
+   the root. */
+static struct free_run *
+pos_remove (struct free_run *t, struct free_run *run)
+{
+  ASSERT (t != NULL);
+  if (t == run)
+    return pos_merge (t->pos_left, t->pos_right);
+  if (run->start < t->start)
+    t->pos_left = pos_remove (t->pos_left, run);
+  else
+    t->pos_right = pos_remove (t->pos_right, run);
+  pos_update (t);
+  return t;
+}
+
+/* Adds RUN to the indexes. */
+static void
+run_insert (struct free_run *run) 
+{
+  ASSERT (run->length > 0);
+  hash_insert (&runs_by_start, &run->start_elem);
+  hash_insert (&runs_by_end, &run->end_elem);
+  run->left = run->right = NULL;
+  run->pos_left = run->pos_right = NULL;
+  run->priority = random_ulong ();
+  runs_by_size = treap_insert (runs_by_size, run);
+  runs_by_pos = pos_insert (runs_by_pos, run);
+}
+
+/* Removes RUN from the indexes. */
+static void
+run_remove (struct free_run *run) 
+{
+  hash_delete (&runs_by_start, &run->start_elem);
+  hash_delete (&runs_by_end, &run->end_elem);
+  runs_by_size = treap_remove (runs_by_size, run);
+  runs_by_pos = pos_remove (runs_by_pos, run);
+}
+
+/* Builds the free runs from the free map.  Leaves RUNS_READY
+   false if memory runs out. */
+static void
+runs_build (void) 
+{
+  size_t size = bitmap_size (free_map);
+  size_t start = 0;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  runs_drop ();
+  while ((start = bitmap_scan (free_map, start, 1, false)) != BITMAP_ERROR)
+    {
+      size_t end = bitmap_scan (free_map, start, 1, true);
+      struct free_run *run = malloc (sizeof *run);
+      if (run == NULL)
+        {
+          runs_drop ();
+          return;
+        }
+      if (end == BITMAP_ERROR)
+        end = size;
+      run->start = start;
+      run->length = end - start;
+      run_insert (run);
+      start = end;
+    }
+  runs_ready = true;
+}
+
+/* Frees all the free runs and goes back to scanning the free
+   map. */
+static void
+runs_drop (void) 
+{
+  while (runs_by_size != NULL)
+    {
+      struct free_run *run = runs_by_size;
+      run_remove (run);
+      free (run);
+    }
+  runs_ready = false;
+}
+
+/* Returns the run starting at SECTOR, or a null pointer if
+   SECTOR does not start a free run. */
+static struct free_run *
+run_find_start (disk_sector_t sector) 
+{
+  struct free_run key;
+  struct hash_elem *e;
+
+  key.start = sector;
+  e = hash_find (&runs_by_start, &key.start_elem);
+  return e != NULL ? hash_entry (e, struct free_run, start_elem) : NULL;
+}
+
+/* Returns the run ending just before SECTOR, or a null pointer
+   if there is none. */
+static struct free_run *
+run_find_end (disk_sector_t sector) 
+{
+  struct free_run key;
+  struct hash_elem *e;
+
+  key.start = sector;
+  key.length = 0;
+  e = hash_find (&runs_by_end, &key.end_elem);
+  return e != NULL ? hash_entry (e, struct free_run, end_elem) : NULL;
+}
+
+/* Returns the first run in runs_by_size that does not order
+   before (LENGTH, START), or a null pointer if there is none. */
+static struct free_run *
+run_ceiling (size_t length, disk_sector_t start)
+{
+  struct free_run *t = runs_by_size;
+  struct free_run *best = NULL;
+
+  while (t != NULL)
+    if (run_size_less (t, length, start))
+      t = t->right;
+    else
+      {
+        best = t;
+        t = t->left;
+      }
+  return best;
+}
+
+/* Returns the last run in runs_by_size that orders before
+   (LENGTH, START), or a null pointer if there is none. */
+static struct free_run *
+run_floor (size_t length, disk_sector_t start)
+{
+  struct free_run *t = runs_by_size;
+  struct free_run *best = NULL;
+
+  while (t != NULL)
+    if (run_size_less (t, length, start))
+      {
+        best = t;
+        t = t->right;
+      }
+    else
+      t = t->left;
+  return best;
+}
+
+/* Returns the first run in the treap by position rooted at T that
+   starts at or after SECTOR and has at least CNT sectors, or a null
+   pointer if there is none.  Subtrees without a long enough run
+   are skipped, so this takes expected logarithmic time. */
+static struct free_run *
+run_next_fit (struct free_run *t, disk_sector_t sector, size_t cnt)
+{
+  struct free_run *run;
+
+  if (t == NULL || t->max_length < cnt)
+    return NULL;
+  if (t->start < sector)
+    return run_next_fit (t->pos_right, sector, cnt);
+  if ((run = run_next_fit (t->pos_left, sector, cnt)) != NULL)
+    return run;
+  if (t->length >= cnt)
+    return t;
+  return run_next_fit (t->pos_right, sector, cnt);
+}
+
+/* Returns the shortest run of at least CNT sectors, preferring the
+   one nearest HINT among runs of that length, or a null pointer
+   if no run is that long.  Takes expected logarithmic time. */
+static struct free_run *
+run_best_fit (size_t cnt, disk_sector_t hint) 
+{
+  struct free_run *shortest = run_ceiling (cnt, 0);
+  struct free_run *after, *before;
+
+  if (shortest == NULL)
+    return NULL;
+
+  /* The runs of that length nearest HINT on either side. */
+  after = run_ceiling (shortest->length, hint);
+  before = run_floor (shortest->length, hint);
+  if (after == NULL || after->length != shortest->length)
+    after = NULL;
+  if (before == NULL || before->length != shortest->length)
+    return after != NULL ? after : shortest;
+  if (after == NULL || hint - before->start < after->start - hint)
+    return before;
+  return after;
+}
+
+/* Allocates the first CNT sectors of RUN, which must have that
+   many, and returns the first of them.  Frees RUN if it is used
+   up. */
+static disk_sector_t
+run_take (struct free_run *run, size_t cnt) 
+{
+  disk_sector_t start = run->start;
+
+  ASSERT (cnt > 0 && cnt <= run->length);
+  run_remove (run);
+  run->start += cnt;
+  run->length -= cnt;
+  if (run->length > 0)
+    run_insert (run);
+  else
+    free (run);
+  return start;
+}
+
+/* Adds the CNT sectors starting at SECTOR to the free runs,
+   merging them with the runs on either side. */
+static void
+run_add (disk_sector_t sector, size_t cnt) 
+{
+  struct free_run *prev = run_find_end (sector);
+  struct free_run *next = run_find_start (sector + cnt);
+
+  if (prev != NULL)
+    {
+      run_remove (prev);
+      prev->length += cnt;
+      if (next != NULL)
+        {
+          run_remove (next);
+          prev->length += next->length;
+          free (next);
+        }
+      run_insert (prev);
+    }
+  else if (next != NULL)
+    {
+      run_remove (next);
+      next->start = sector;
+      next->length += cnt;
+      run_insert (next);
+    }
+  else
+    {
+      struct free_run *run = malloc (sizeof *run);
+      if (run == NULL)
+        {
+          runs_drop ();
+          return;
+        }
+      run->start = sector;
+      run->length = cnt;
+      run_insert (run);
+    }
+}
+
+/* Hashes a run by where it starts. */
+static unsigned
+run_start_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct free_run *run = hash_entry (e, struct free_run, start_elem);
+  return hash_int (run->start);
+}
+
+/* Orders runs by where they start. */
+static bool
+run_start_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                void *aux UNUSED) 
+{
+  const struct free_run *a = hash_entry (a_, struct free_run, start_elem);
+  const struct free_run *b = hash_entry (b_, struct free_run, start_elem);
+  return a->start < b->start;
+}
+
+/* Hashes a run by where it ends. */
+static unsigned
+run_end_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct free_run *run = hash_entry (e, struct free_run, end_elem);
+  return hash_int (run->start + run->length);
+}
+
+/* Orders runs by where they end. */
+static bool
+run_end_less (const struct hash_elem *a_, const struct hash_elem *b_,
+              void *aux UNUSED) 
+{
+  const struct free_run *a = hash_entry (a_, struct free_run, end_elem);
+  const struct free_run *b = hash_entry (b_, struct free_run, end_elem);
+  return a->start + a->length < b->start + b->length;
 }
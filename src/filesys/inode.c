@@ -1,27 +1,69 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdint.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "filesys/cache.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of LENGTH consecutive sectors starting at START, holding
+   the file's blocks starting at block OFFSET. */
+struct extent
+  {
+    uint32_t offset;                    /* First file block. */
+    disk_sector_t start;                /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Number of extents stored in the inode itself, and in each
+   overflow extent block. */
+#define INODE_EXTENTS 40
+#define BLOCK_EXTENTS 42
+
+/* Inode flags. */
+#define INODE_INLINE 1                  /* Data stored in the inode. */
+
 /* On-disk inode.
-   Must be exactly DISK_SECTOR_SIZE bytes long. */
+   Must be exactly DISK_SECTOR_SIZE bytes long.
+
+   The data of files up to INODE_INLINE_MAX bytes long is stored
+   in the inode itself, with INODE_INLINE set in FLAGS.  Other
+   files are mapped by extents sorted by offset.  The first
+   INODE_EXTENTS are stored here, the rest in a chain of extent
+   blocks starting at NEXT. */
 struct inode_disk
   {
     enum file_type type;                /* File type. */
     off_t length;                       /* File size in bytes. */
     disk_sector_t parent;               /* Parent directory pointer. */
     unsigned magic;                     /* Magic number. */
-    disk_sector_t pointers[14];         /* Block pointers. */
-    uint32_t unused[110];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    disk_sector_t next;                 /* First extent block, or 0. */
+    union
+      {
+        struct extent extents[INODE_EXTENTS]; /* First extents. */
+        uint8_t data[INODE_INLINE_MAX]; /* Inline data. */
+      };
+    uint32_t flags;                     /* INODE_* flags. */
+    uint32_t unused;                    /* Not used. */
+  };
+
+/* Overflow extent block.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    disk_sector_t next;                 /* Next extent block, or 0. */
+    uint32_t unused;                    /* Not used. */
+    struct extent extents[BLOCK_EXTENTS]; /* Further extents. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -32,177 +74,411 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
+/* Number of closed inodes kept in memory for reopening. */
+#define INODE_CLOSED_MAX 32
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in open_inodes. */
+    struct list_elem elem;              /* Element in closed_inodes. */
     disk_sector_t sector;               /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* Being read by inode_open(). */
+    bool load_failed;                   /* Reading it failed. */
+    struct condition loaded;            /* Signaled when LOADING clears. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     int pwd_cnt;                        /* 0: remove ok, >0: deny remove. */
-    struct lock mutex;                  /* Synchronization. */
+    struct rwlock rwlock;               /* Shared for reading, exclusive
+                                           for changing the inode. */
+    struct inode_disk data;             /* Inode content. */
+
+    /* All DATA.EXTENT_CNT extents, of which DATA.EXTENTS holds a
+       copy of the first ones when written back. */
+    struct extent *extents;
+    size_t extent_cap;                  /* Allocated size of EXTENTS. */
+    size_t extent_hint;                 /* Last extent looked up. */
+    size_t extent_dirty;                /* First extent not on disk,
+                                           SIZE_MAX if none. */
+    disk_sector_t *blocks;              /* Overflow extent blocks. */
+    size_t block_cnt;                   /* Number of BLOCKS. */
   };
 
-#define TABLE_SIZE (DISK_SECTOR_SIZE / (int) sizeof(disk_sector_t))
+static void inode_write_back (struct inode *inode);
+
+/* Returns the index of the extent of INODE that holds file block
+   BLOCK, or -1 if there is none.  Readers sharing INODE's rwlock
+   may race on EXTENT_HINT, which is harmless: it is only a
+   starting guess and always a valid index. */
+static int
+extent_find (struct inode *inode, uint32_t block)
+{
+  const struct extent *e = inode->extents;
+  size_t cnt = inode->data.extent_cnt;
+  size_t i = inode->extent_hint;
+  size_t lo, hi;
+
+  /* Sequential access stays in the same extent or moves to the
+     next one. */
+  if (i < cnt && block >= e[i].offset)
+    {
+      if (block < e[i].offset + e[i].length)
+        return i;
+      if (i + 1 < cnt && block >= e[i + 1].offset
+          && block < e[i + 1].offset + e[i + 1].length)
+        return inode->extent_hint = i + 1;
+    }
+
+  lo = 0;
+  hi = cnt;
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (block < e[mid].offset)
+        hi = mid;
+      else if (block >= e[mid].offset + e[mid].length)
+        lo = mid + 1;
+      else
+        return inode->extent_hint = mid;
+    }
+  return -1;
+}
+
+/* Returns how accesses to INODE's contents are counted in the
+   buffer cache statistics. */
+static enum cache_access
+inode_access (const struct inode *inode)
+{
+  return (inode->data.type == FILE_TYPE_DIR
+          || inode->sector == FREE_MAP_SECTOR ? CACHE_META : CACHE_DATA);
+}
 
 /* Returns the disk sector that contains byte offset POS within
    INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
-  if (pos < inode_length(inode)) {
-    disk_sector_t sector_idx;
-    int index = pos / DISK_SECTOR_SIZE;
-    if (index < 12) {
-      cache_read(inode->sector,
-                 &sector_idx,
-                 offsetof(struct inode_disk, pointers[index]),
-                 sizeof(disk_sector_t));
-      if (!sector_idx)
-        return -1;
-    } else if (index < 12 + TABLE_SIZE) {
-      cache_read(inode->sector,
-                 &sector_idx,
-                 offsetof(struct inode_disk, pointers[12]),
-                 sizeof(disk_sector_t));
-      if (!sector_idx)
-        return -1;
-      cache_read(sector_idx,
-                 &sector_idx,
-                 (index - 12) * sizeof(disk_sector_t),
-                 sizeof(disk_sector_t));
-      if (!sector_idx)
-        return -1;
-    } else if (index < 12 + TABLE_SIZE + TABLE_SIZE * TABLE_SIZE) {
-      cache_read(inode->sector,
-                 &sector_idx,
-                 offsetof(struct inode_disk, pointers[13]),
-                 sizeof(disk_sector_t));
-      if (!sector_idx)
-        return -1;
-      cache_read(sector_idx,
-                 &sector_idx,
-                 (index - 12 - TABLE_SIZE) / TABLE_SIZE * sizeof(disk_sector_t),
-                 sizeof(disk_sector_t));
-      if (!sector_idx)
-        return -1;
-      cache_read(sector_idx,
-                 &sector_idx,
-                 (index - 12 - TABLE_SIZE) % TABLE_SIZE * sizeof(disk_sector_t),
-                 sizeof(disk_sector_t));
-      if (!sector_idx)
-        return -1;
-    } else {
-      return -1;
-    }
-    return sector_idx;
-  } else {
+  uint32_t block = pos / DISK_SECTOR_SIZE;
+  int i;
+
+  if (pos >= inode->data.length || (i = extent_find (inode, block)) < 0)
     return -1;
-  }
+  return inode->extents[i].start + (block - inode->extents[i].offset);
 }
 
-static bool extend_one_block(struct inode *inode, off_t incr)
+/* Makes room in INODE for one more extent, in memory and on disk.
+   Returns false if memory or disk allocation fails. */
+static bool
+extent_reserve (struct inode *inode)
 {
-  disk_sector_t sector_idx;
-  disk_sector_t table1;
-  disk_sector_t table2;
+  size_t cnt = inode->data.extent_cnt;
 
-  int index = (inode_length(inode) + DISK_SECTOR_SIZE - 1) / DISK_SECTOR_SIZE;
-  if (index < 12) {
-    if (!free_map_allocate(1, &sector_idx))
-      return false;
-    cache_write(inode->sector,
-                &sector_idx,
-                offsetof(struct inode_disk, pointers[index]),
-                sizeof(disk_sector_t));
-  } else if (index < 12 + TABLE_SIZE) {
-    cache_read(inode->sector,
-               &table1,
-               offsetof(struct inode_disk, pointers[12]),
-               sizeof(disk_sector_t));
-    if (!table1) {
-      if (!free_map_allocate(1, &table1))
+  if (cnt == inode->extent_cap)
+    {
+      size_t cap = inode->extent_cap * 2;
+      struct extent *extents = realloc (inode->extents,
+                                        cap * sizeof *extents);
+      if (extents == NULL)
         return false;
-      cache_write(inode->sector,
-                  &table1,
-                  offsetof(struct inode_disk, pointers[12]),
-                  sizeof(disk_sector_t));
+      inode->extents = extents;
+      inode->extent_cap = cap;
     }
-    if (!free_map_allocate(1, &sector_idx))
-      return false;
-    cache_write(table1,
-                &sector_idx,
-                (index - 12) * sizeof(disk_sector_t),
-                sizeof(disk_sector_t));
-  } else if (index < 12 + TABLE_SIZE + TABLE_SIZE * TABLE_SIZE) {
-    cache_read(inode->sector,
-               &table2,
-               offsetof(struct inode_disk, pointers[13]),
-               sizeof(disk_sector_t));
-    if (!table2) {
-      if (!free_map_allocate(1, &table2))
+
+  if (cnt == INODE_EXTENTS + inode->block_cnt * BLOCK_EXTENTS)
+    {
+      disk_sector_t *blocks = realloc (inode->blocks,
+                                       (inode->block_cnt + 1)
+                                       * sizeof *blocks);
+      if (blocks == NULL)
         return false;
-      cache_write(inode->sector,
-                  &table2,
-                  offsetof(struct inode_disk, pointers[13]),
-                  sizeof(disk_sector_t));
-    }
-    cache_read(table2,
-               &table1,
-               (index - 12 - TABLE_SIZE) / TABLE_SIZE * sizeof(disk_sector_t),
-               sizeof(disk_sector_t));
-    if (!table1) {
-      if (!free_map_allocate(1, &table1))
+      inode->blocks = blocks;
+      if (!free_map_allocate_near (1, inode->sector,
+                                   &blocks[inode->block_cnt])
+          && (!inode_reclaim_wait ()
+              || !free_map_allocate_near (1, inode->sector,
+                                          &blocks[inode->block_cnt])))
         return false;
-      cache_write(table2,
-                  &table1,
-                  (index - 12 - TABLE_SIZE) / TABLE_SIZE * sizeof(disk_sector_t),
-                  sizeof(disk_sector_t));
+      inode->block_cnt++;
+
+      /* Link the new block in. */
+      if (inode->extent_dirty > cnt)
+        inode->extent_dirty = cnt;
+      if (inode->block_cnt == 1)
+        inode->data.next = blocks[0];
+      else if (inode->extent_dirty > cnt - BLOCK_EXTENTS)
+        inode->extent_dirty = cnt - BLOCK_EXTENTS;
     }
-    if (!free_map_allocate(1, &sector_idx))
-      return false;
-    cache_write(table1,
-                &sector_idx,
-                (index - 12 - TABLE_SIZE) % TABLE_SIZE * sizeof(disk_sector_t),
-                sizeof(disk_sector_t));
-  } else {
-    return false;
-  }
+  return true;
+}
+
+/* Returns the index of the first extent of INODE that starts
+   after file block BLOCK, which must not be mapped. */
+static size_t
+extent_insert_pos (struct inode *inode, uint32_t block)
+{
+  const struct extent *e = inode->extents;
+  size_t lo = 0;
+  size_t hi = inode->data.extent_cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (e[mid].offset <= block)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
 
-  off_t new_length = inode_length(inode) + incr;
-  cache_write(inode->sector,
-              &new_length,
-              offsetof(struct inode_disk, length),
-              sizeof(off_t));
+/* Allocates sectors for the unmapped blocks among INODE's file
+   blocks FIRST up to END, in runs that are as long as possible.
+   An extent that ends right before a hole is extended in place
+   when the sectors after it are free.  The caller must write back
+   INODE.
 
+   New sectors are zeroed, except those lying entirely within the
+   bytes from WRITE_OFS to WRITE_END, which the caller is about to
+   overwrite.
+   If the disk looks full, waits once for the sectors of removed
+   inodes to be reclaimed and tries again.
+   Returns false if the disk fills up, in which case only some of
+   the blocks may have been allocated. */
+static bool
+inode_allocate (struct inode *inode, uint32_t first, uint32_t end,
+                off_t write_ofs, off_t write_end)
+{
   static char zeros[DISK_SECTOR_SIZE];
-  cache_write(sector_idx, zeros, 0, DISK_SECTOR_SIZE);
+  uint32_t skip_first = DIV_ROUND_UP (write_ofs, DISK_SECTOR_SIZE);
+  uint32_t skip_end = write_end / DISK_SECTOR_SIZE;
+  uint32_t block = first;
+  bool waited = false;
+
+  while (block < end)
+    {
+      size_t cnt = inode->data.extent_cnt;
+      size_t pos;
+      struct extent *prev;
+      uint32_t need;
+      disk_sector_t start;
+      disk_sector_t hint;
+      size_t got;
+      size_t i;
+      int e;
+
+      /* Skip blocks that are already mapped. */
+      if ((e = extent_find (inode, block)) >= 0)
+        {
+          block = inode->extents[e].offset + inode->extents[e].length;
+          continue;
+        }
+
+      /* Find the hole BLOCK lies in. */
+      pos = extent_insert_pos (inode, block);
+      need = (pos < cnt && inode->extents[pos].offset < end
+              ? inode->extents[pos].offset : end) - block;
+      prev = pos > 0 ? &inode->extents[pos - 1] : NULL;
+
+      if (prev != NULL && prev->offset + prev->length == block
+          && (got = free_map_extend (prev->start + prev->length, need)) > 0)
+        {
+          start = prev->start + prev->length;
+          prev->length += got;
+          if (inode->extent_dirty > pos - 1)
+            inode->extent_dirty = pos - 1;
+        }
+      else
+        {
+          /* Look for space right after the preceding extent, or
+             else after the inode itself.  (PREV is not valid
+             after extent_reserve().) */
+          hint = prev != NULL ? prev->start + prev->length : inode->sector + 1;
+          if (!extent_reserve (inode))
+            break;
+          for (got = need;
+               got > 0 && !free_map_allocate_near (got, hint, &start);
+               got /= 2)
+            continue;
+          if (got == 0 && !waited)
+            {
+              waited = true;
+              if (inode_reclaim_wait ())
+                continue;
+            }
+          if (got == 0)
+            break;
+          memmove (&inode->extents[pos + 1], &inode->extents[pos],
+                   (cnt - pos) * sizeof *inode->extents);
+          inode->extents[pos].offset = block;
+          inode->extents[pos].start = start;
+          inode->extents[pos].length = got;
+          inode->data.extent_cnt++;
+          if (inode->extent_dirty > pos)
+            inode->extent_dirty = pos;
+        }
+
+      for (i = 0; i < got; i++)
+        if (block + i < skip_first || block + i >= skip_end)
+          cache_write (start + i, zeros, 0, DISK_SECTOR_SIZE,
+                       inode_access (inode));
+      block += got;
+    }
+  return block >= end;
+}
+
+/* Reads INODE's on-disk inode and extent blocks into memory.
+   Returns false if memory allocation fails. */
+static bool
+inode_load (struct inode *inode)
+{
+  struct inode_disk *data = &inode->data;
+  disk_sector_t next;
+  size_t i;
+
+  cache_read (inode->sector, data, 0, DISK_SECTOR_SIZE, CACHE_META);
+  inode->extent_cap = data->extent_cnt > 4 ? data->extent_cnt : 4;
+  inode->extents = malloc (inode->extent_cap * sizeof *inode->extents);
+  inode->extent_hint = 0;
+  inode->extent_dirty = SIZE_MAX;
+  inode->blocks = NULL;
+  inode->block_cnt = 0;
+  if (inode->extents == NULL)
+    return false;
+
+  for (i = 0; i < data->extent_cnt && i < INODE_EXTENTS; i++)
+    inode->extents[i] = data->extents[i];
+
+  /* Follow the whole chain: a block may have been linked in for
+     an extent that could not be allocated after all. */
+  for (next = data->next; next != 0; )
+    {
+      size_t first = INODE_EXTENTS + inode->block_cnt * BLOCK_EXTENTS;
+      disk_sector_t *blocks = realloc (inode->blocks,
+                                       (inode->block_cnt + 1)
+                                       * sizeof *blocks);
+      struct extent_block *block;
+
+      if (blocks == NULL)
+        {
+          free (inode->extents);
+          free (inode->blocks);
+          return false;
+        }
+      inode->blocks = blocks;
+      blocks[inode->block_cnt++] = next;
+
+      block = cache_get (next);
+      for (i = 0; first + i < data->extent_cnt && i < BLOCK_EXTENTS; i++)
+        inode->extents[first + i] = block->extents[i];
+      next = block->next;
+      cache_put (block, false);
+    }
   return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Frees every sector INODE occupies on disk, including the inode
+   itself. */
+static void
+inode_release (struct inode *inode)
+{
+  size_t i;
+
+  for (i = 0; i < inode->data.extent_cnt; i++)
+    free_map_release (inode->extents[i].start, inode->extents[i].length);
+  for (i = 0; i < inode->block_cnt; i++)
+    free_map_release (inode->blocks[i], 1);
+  free_map_release (inode->sector, 1);
+}
+
+/* Open inodes, so that opening a single inode twice returns the
+   same `struct inode', plus up to INODE_CLOSED_MAX inodes that
+   have been closed but not removed, which can be reopened without
+   reading the disk.  The closed ones have an OPEN_CNT of 0 and
+   are kept in closed_inodes, least recently closed first.
+
+   OPEN_INODES_MUTEX protects the table, closed_inodes and every
+   inode's OPEN_CNT, LOADING and LOAD_FAILED.  It may be acquired
+   while holding an inode's rwlock but not the other way around.
+   It is not held during disk I/O: an inode is entered in the table
+   before it is read, and other openers wait for it to be loaded. */
+static struct hash open_inodes;
+static struct list closed_inodes;
+static size_t closed_cnt;
 
 static struct lock open_inodes_mutex;
 
+/* Removed inodes whose last opener has closed them, waiting for
+   the reclaim thread to free their sectors.  RECLAIM_LOCK protects
+   the list and RECLAIM_BUSY. */
+static struct list reclaim_list;
+static struct lock reclaim_lock;
+static struct condition reclaim_ready;  /* RECLAIM_LIST not empty. */
+static struct condition reclaim_idle;   /* Nothing left to reclaim. */
+static bool reclaim_busy;
+
+static void reclaim_thread (void *aux);
+
+/* Buffer in which inode_write_back() builds extent blocks, too big
+   for the stack. */
+static struct extent_block extent_block_buf;
+static struct lock extent_block_lock;
+
+static struct inode *inode_lookup (disk_sector_t sector);
+static void inode_forget (disk_sector_t sector);
+static void inode_free (struct inode *inode);
+static unsigned inode_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool inode_less (const struct hash_elem *a_,
+                        const struct hash_elem *b_, void *aux UNUSED);
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
   lock_init(&open_inodes_mutex);
+  lock_init (&extent_block_lock);
+  list_init (&reclaim_list);
+  lock_init (&reclaim_lock);
+  cond_init (&reclaim_ready);
+  cond_init (&reclaim_idle);
+  thread_create ("reclaim", PRI_DEFAULT, reclaim_thread, NULL);
+}
+
+/* Waits until the sectors of every removed inode have been
+   freed. */
+void
+inode_done (void)
+{
+  inode_reclaim_wait ();
+}
+
+/* Waits until the sectors of every removed inode have been freed.
+   Returns true if there were any to wait for, in which case an
+   allocation that failed for want of space is worth retrying. */
+bool
+inode_reclaim_wait (void)
+{
+  bool pending;
+
+  lock_acquire (&reclaim_lock);
+  pending = !list_empty (&reclaim_list) || reclaim_busy;
+  while (!list_empty (&reclaim_list) || reclaim_busy)
+    cond_wait (&reclaim_idle, &reclaim_lock);
+  lock_release (&reclaim_lock);
+  return pending;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
    disk.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails.  No data blocks are
+   allocated until they are written. */
 bool
 inode_create (disk_sector_t sector, off_t length)
 {
@@ -214,26 +490,20 @@ inode_create (disk_sector_t sector, off_t length)
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_block) == DISK_SECTOR_SIZE);
 
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
+      /* A small file starts out inline and zeroed, a larger one as
+         one big hole. */
+      disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      cache_write(sector, disk_inode, 0, DISK_SECTOR_SIZE);
-      struct inode *inode = inode_open(sector);
+      if (length <= INODE_INLINE_MAX)
+        disk_inode->flags = INODE_INLINE;
+      inode_forget(sector);
+      cache_write(sector, disk_inode, 0, DISK_SECTOR_SIZE, CACHE_META);
       success = true;
-      size_t i;
-      for (i = 0; i < sectors; i++) {
-        off_t incr = (length >= DISK_SECTOR_SIZE) ? DISK_SECTOR_SIZE : length;
-        if (!extend_one_block(inode, incr)) {
-          inode_remove(inode);
-          success = false;
-          break;
-        }
-        length -= incr;
-      }
-      inode_close(inode);
       free (disk_inode);
     }
   return success;
@@ -245,21 +515,33 @@ inode_create (disk_sector_t sector, off_t length)
 struct inode *
 inode_open (disk_sector_t sector) 
 {
-  struct list_elem *e;
   struct inode *inode;
+  bool loaded;
 
   lock_acquire(&open_inodes_mutex);
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open or recently closed. */
+  inode = inode_lookup(sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      if (inode->open_cnt++ == 0)
+        {
+          list_remove (&inode->elem);
+          closed_cnt--;
+        }
+
+      /* Another opener may still be reading it. */
+      while (inode->loading)
+        cond_wait (&inode->loaded, &open_inodes_mutex);
+      if (inode->load_failed)
         {
+          bool last = --inode->open_cnt == 0;
           lock_release(&open_inodes_mutex);
-          inode_reopen (inode);
-          return inode; 
+          if (last)
+            free (inode);
+          return NULL;
         }
+      lock_release(&open_inodes_mutex);
+      return inode; 
     }
 
   /* Allocate memory. */
@@ -269,15 +551,40 @@ inode_open (disk_sector_t sector)
     return NULL;
   }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  lock_release(&open_inodes_mutex);
+  /* Initialize, and enter INODE in the table as loading, so that
+     other openers of SECTOR wait for it without holding up the
+     rest of the table during the disk reads. */
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loading = true;
+  inode->load_failed = false;
+  cond_init (&inode->loaded);
   inode->deny_write_cnt = 0;
   inode->removed = false;
   inode->pwd_cnt = 0;
-  lock_init(&inode->mutex);
+  rwlock_init(&inode->rwlock);
+  hash_insert (&open_inodes, &inode->hash_elem);
+  lock_release(&open_inodes_mutex);
+
+  loaded = inode_load (inode);
+
+  lock_acquire(&open_inodes_mutex);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &open_inodes_mutex);
+  if (!loaded)
+    {
+      /* Openers that were waiting free INODE once they see this. */
+      bool last;
+
+      inode->load_failed = true;
+      hash_delete (&open_inodes, &inode->hash_elem);
+      last = --inode->open_cnt == 0;
+      lock_release(&open_inodes_mutex);
+      if (last)
+        free (inode);
+      return NULL;
+    }
+  lock_release(&open_inodes_mutex);
   return inode;
 }
 
@@ -286,12 +593,10 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL) {
-    bool flag = lock_held_by_current_thread(&inode->mutex);
-    if (!flag)
-      lock_acquire(&inode->mutex);
+    lock_acquire(&open_inodes_mutex);
+    ASSERT (inode->open_cnt > 0);
     inode->open_cnt++;
-    if (!flag)
-      lock_release(&inode->mutex);
+    lock_release(&open_inodes_mutex);
   }
   return inode;
 }
@@ -303,101 +608,95 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
-/* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+/* Closes INODE.
+   If this was the last reference to INODE, keeps it among the
+   recently closed inodes, or queues it for the reclaim thread to
+   free it and its blocks if INODE was removed. */
 void
 inode_close (struct inode *inode) 
 {
+  struct inode *victim = NULL;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  bool flag = lock_held_by_current_thread(&inode->mutex);
-  if (!flag)
-    lock_acquire(&inode->mutex);
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire(&open_inodes_mutex);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      lock_release(&open_inodes_mutex);
+      return;
+    }
+
+  if (inode->removed)
+    {
+      /* Remove from inode table and release lock. */
+      hash_delete (&open_inodes, &inode->hash_elem);
+      lock_release(&open_inodes_mutex);
+
+      /* Leave deallocating its blocks to the reclaim thread. */
+      lock_acquire (&reclaim_lock);
+      list_push_back (&reclaim_list, &inode->elem);
+      cond_signal (&reclaim_ready, &reclaim_lock);
+      lock_release (&reclaim_lock);
+      return;
+    }
+
+  /* Keep INODE for reopening, dropping the least recently closed
+     inode if there are too many. */
+  list_push_back (&closed_inodes, &inode->elem);
+  if (++closed_cnt > INODE_CLOSED_MAX)
+    {
+      victim = list_entry (list_pop_front (&closed_inodes),
+                           struct inode, elem);
+      hash_delete (&open_inodes, &victim->hash_elem);
+      closed_cnt--;
+    }
+  lock_release(&open_inodes_mutex);
+  inode_free (victim);
+}
+
+/* Writes the in-memory copy of INODE's on-disk inode through to
+   the buffer cache, along with the extent blocks holding extents
+   that changed.  Must be called after every change to it. */
+static void
+inode_write_back (struct inode *inode)
+{
+  struct inode_disk *data = &inode->data;
+  size_t i;
+
+  for (i = inode->extent_dirty; i < data->extent_cnt && i < INODE_EXTENTS;
+       i++)
+    data->extents[i] = inode->extents[i];
+  cache_write(inode->sector, data, 0, DISK_SECTOR_SIZE, CACHE_META);
+
+  if (inode->extent_dirty != SIZE_MAX)
+    {
+      /* Each block is rebuilt whole, so writing it as a full
+         sector spares the cache from reading it first. */
+      struct extent_block *block = &extent_block_buf;
+
+      i = inode->extent_dirty < INODE_EXTENTS ? 0
+          : (inode->extent_dirty - INODE_EXTENTS) / BLOCK_EXTENTS;
+      lock_acquire (&extent_block_lock);
+      for (; i < inode->block_cnt; i++)
         {
-          disk_sector_t sector_idx;
-          disk_sector_t table1;
-          disk_sector_t table2;
-
-          cache_read(inode->sector,
-                     &table2,
-                     offsetof(struct inode_disk, pointers[13]),
-                     sizeof(disk_sector_t));
-          if (table2) {
-            int i;
-            for (i = 0; i < TABLE_SIZE; i++) {
-              cache_read(table2,
-                         &table1,
-                         i * sizeof(disk_sector_t),
-                         sizeof(disk_sector_t));
-              if (table1) {
-                int j;
-                for (j = 0; j < TABLE_SIZE; j++) {
-                  cache_read(table1,
-                             &sector_idx,
-                             j * sizeof(disk_sector_t),
-                             sizeof(disk_sector_t));
-                  if (sector_idx)
-                    free_map_release(sector_idx, 1);
-                  else
-                    break;
-                }
-                free_map_release(table1, 1);
-              } else {
-                break;
-              }
-            }
-            free_map_release(table2, 1);
-          }
-
-          cache_read(inode->sector,
-                     &table1,
-                     offsetof(struct inode_disk, pointers[12]),
-                     sizeof(disk_sector_t));
-          if (table1) {
-            int i;
-            for (i = 0; i < TABLE_SIZE; i++) {
-              cache_read(table1,
-                         &sector_idx,
-                         i * sizeof(disk_sector_t),
-                         sizeof(disk_sector_t));
-              if (sector_idx)
-                free_map_release(sector_idx, 1);
-              else
-                break;
-            }
-            free_map_release(table1, 1);
-          }
-
-          int i;
-          for (i = 0; i < 12; i++) {
-            cache_read(inode->sector,
-                       &sector_idx,
-                       offsetof(struct inode_disk, pointers[i]),
-                       sizeof(disk_sector_t));
-            if (sector_idx)
-              free_map_release(sector_idx, 1);
-            else
-              break;
-          }
-          free_map_release (inode->sector, 1);
-        }
+          size_t first = INODE_EXTENTS + i * BLOCK_EXTENTS;
+          size_t cnt = first < data->extent_cnt
+                       ? data->extent_cnt - first : 0;
 
-      free (inode); 
-      inode = NULL;
+          if (cnt > BLOCK_EXTENTS)
+            cnt = BLOCK_EXTENTS;
+          memset (block, 0, DISK_SECTOR_SIZE);
+          block->next = i + 1 < inode->block_cnt ? inode->blocks[i + 1] : 0;
+          memcpy (block->extents, &inode->extents[first],
+                  cnt * sizeof *block->extents);
+          cache_write(inode->blocks[i], block, 0, DISK_SECTOR_SIZE,
+                      CACHE_META);
+        }
+      lock_release (&extent_block_lock);
     }
-  if (inode && !flag)
-    lock_release(&inode->mutex);
+  inode->extent_dirty = SIZE_MAX;
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -406,12 +705,12 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
-  bool flag = lock_held_by_current_thread(&inode->mutex);
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
   if (!flag)
-    lock_acquire(&inode->mutex);
+    rwlock_acquire_write(&inode->rwlock);
   inode->removed = true;
   if (!flag)
-    lock_release(&inode->mutex);
+    rwlock_release_write(&inode->rwlock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -423,9 +722,9 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
 
-  bool flag = lock_held_by_current_thread(&inode->mutex);
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
   if (!flag)
-    lock_acquire(&inode->mutex);
+    rwlock_acquire_read(&inode->rwlock);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -433,7 +732,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       int sector_ofs = offset % DISK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = inode->data.length - offset;
       int sector_left = DISK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -442,7 +741,14 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      cache_read(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      /* Holes read as zeros. */
+      if (inode->data.flags & INODE_INLINE)
+        memcpy (buffer + bytes_read, inode->data.data + offset, chunk_size);
+      else if (sector_idx == (disk_sector_t) -1)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else
+        cache_read(sector_idx, buffer + bytes_read, sector_ofs, chunk_size,
+                   inode_access(inode));
       
       /* Advance. */
       size -= chunk_size;
@@ -450,16 +756,158 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       bytes_read += chunk_size;
     }
   if (!flag)
-    lock_release(&inode->mutex);
+    rwlock_release_read(&inode->rwlock);
 
   return bytes_read;
 }
 
+/* Asks the buffer cache to prefetch the sectors holding the SIZE
+   bytes of INODE starting at OFFSET.  Bytes past end of file are
+   ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t size, off_t offset)
+{
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
+  if (!flag)
+    rwlock_acquire_read(&inode->rwlock);
+  off_t end = offset + size;
+  if (end > inode->data.length)
+    end = inode->data.length;
+  for (offset = ROUND_DOWN(offset, DISK_SECTOR_SIZE); offset < end;
+       offset += DISK_SECTOR_SIZE)
+    {
+      disk_sector_t sector_idx = byte_to_sector(inode, offset);
+      if (sector_idx != (disk_sector_t) -1)
+        cache_read_ahead(sector_idx);
+    }
+  if (!flag)
+    rwlock_release_read(&inode->rwlock);
+}
+
+/* Returns the cached sector of INODE that holds byte OFFSET,
+   pinned in the buffer cache so it can be read in place, or a null
+   pointer if OFFSET is past end of file or in a hole.  The caller
+   must release the block with inode_put_block() and must not
+   modify it.
+   Unless the caller holds INODE's lock exclusively, INODE stays
+   locked shared until then, so that the block cannot be moved or
+   freed under the caller, as when inline data is moved out to a
+   data block.  The caller must not call other inode functions on
+   INODE in the meantime. */
+const void *
+inode_get_block (struct inode *inode, off_t offset)
+{
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
+  if (!flag)
+    rwlock_acquire_read(&inode->rwlock);
+  disk_sector_t sector_idx = byte_to_sector(inode, offset);
+  const void *block = NULL;
+  if (inode->data.flags & INODE_INLINE) {
+    /* The inline data, as if it started a sector. */
+    if (offset < inode->data.length)
+      block = (const uint8_t *) cache_get(inode->sector)
+              + offsetof (struct inode_disk, data);
+  } else if (sector_idx != (disk_sector_t) -1) {
+    block = cache_get(sector_idx);
+  }
+  if (!flag && block == NULL)
+    rwlock_release_read(&inode->rwlock);
+  return block;
+}
+
+/* Releases BLOCK, obtained from inode_get_block() on INODE. */
+void
+inode_put_block (struct inode *inode, const void *block)
+{
+  cache_put(block, false);
+  if (!rwlock_held_by_current_thread(&inode->rwlock))
+    rwlock_release_read(&inode->rwlock);
+}
+
+/* Moves INODE's inline data out to newly allocated blocks.
+   Returns false if the disk is full, in which case INODE is left
+   inline. */
+static bool
+inode_uninline (struct inode *inode)
+{
+  off_t length = inode->data.length;
+  uint8_t *copy;
+  size_t i;
+
+  ASSERT (inode->data.flags & INODE_INLINE);
+  ASSERT (inode->data.extent_cnt == 0);
+
+  copy = malloc (INODE_INLINE_MAX);
+  if (copy == NULL)
+    return false;
+  memcpy (copy, inode->data.data, INODE_INLINE_MAX);
+
+  if (!inode_allocate (inode, 0, bytes_to_sectors (length), 0, length))
+    {
+      for (i = 0; i < inode->data.extent_cnt; i++)
+        free_map_release (inode->extents[i].start, inode->extents[i].length);
+      inode->data.extent_cnt = 0;
+      inode->extent_dirty = SIZE_MAX;
+      free (copy);
+      return false;
+    }
+  for (i = 0; i * DISK_SECTOR_SIZE < (size_t) length; i++)
+    {
+      size_t chunk = length - i * DISK_SECTOR_SIZE;
+      if (chunk > DISK_SECTOR_SIZE)
+        chunk = DISK_SECTOR_SIZE;
+      cache_write (byte_to_sector (inode, i * DISK_SECTOR_SIZE),
+                   copy + i * DISK_SECTOR_SIZE, 0, chunk,
+                   inode_access (inode));
+    }
+  free (copy);
+
+  inode->data.flags &= ~INODE_INLINE;
+  inode->extent_dirty = 0;
+  inode_write_back (inode);
+  return true;
+}
+
+/* Writes bytes from BUFFER into INODE, starting at OFFSET, as long
+   as they fall into allocated blocks inside the file, up to SIZE
+   bytes.  Returns the number of bytes written.  Needs INODE's
+   rwlock held only for reading. */
+static off_t
+inode_overwrite (struct inode *inode, const uint8_t *buffer, off_t size,
+                 off_t offset)
+{
+  off_t bytes_written = 0;
+
+  while (size > 0)
+    {
+      disk_sector_t sector_idx = byte_to_sector (inode, offset);
+      int sector_ofs = offset % DISK_SECTOR_SIZE;
+
+      /* Bytes left in inode, bytes left in sector, lesser of the two. */
+      off_t inode_left = inode->data.length - offset;
+      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
+      int min_left = inode_left < sector_left ? inode_left : sector_left;
+
+      /* Number of bytes to actually write into this sector. */
+      int chunk_size = size < min_left ? size : min_left;
+      if (chunk_size <= 0 || sector_idx == (disk_sector_t) -1)
+        break;
+
+      cache_write(sector_idx, buffer + bytes_written, sector_ofs, chunk_size,
+                  inode_access(inode));
+
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+  return bytes_written;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk is full or an error occurs.
+   Writing past end of file extends the inode. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
@@ -467,63 +915,81 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
 
-  bool flag = lock_held_by_current_thread(&inode->mutex);
-  if (!flag)
-    lock_acquire(&inode->mutex);
-  if (inode->deny_write_cnt) {
-    if (!flag)
-      lock_release(&inode->mutex);
-    return 0;
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
+  if (!flag) {
+    /* Overwriting allocated blocks inside the file leaves the inode
+       alone, so try that under a shared lock first. */
+    rwlock_acquire_read(&inode->rwlock);
+    if (!inode->deny_write_cnt)
+      bytes_written = inode_overwrite(inode, buffer, size, offset);
+    rwlock_release_read(&inode->rwlock);
+    if (bytes_written == size)
+      return bytes_written;
+    rwlock_acquire_write(&inode->rwlock);
   }
+  if (inode->deny_write_cnt)
+    goto done;
+  size -= bytes_written;
+  offset += bytes_written;
 
-  while (size > 0) 
+  /* Inline data is written in place, until the file outgrows the
+     inode and moves to blocks. */
+  if (inode->data.flags & INODE_INLINE) {
+    if (offset + size <= INODE_INLINE_MAX) {
+      memcpy(inode->data.data + offset, buffer + bytes_written, size);
+      bytes_written += size;
+      if (offset + size > inode->data.length)
+        inode->data.length = offset + size;
+      inode_write_back(inode);
+      goto done;
+    }
+    if (!inode_uninline(inode))
+      goto done;
+  }
+
+  /* Allocate the blocks being written that are still holes, and
+     grow the file if the write extends past its end.  Blocks
+     skipped over stay holes.  If the disk fills up, write as much
+     as fits. */
+  off_t old_length = inode->data.length;
+  if (size > 0)
     {
-      off_t length = inode_length(inode);
+      inode_allocate(inode, offset / DISK_SECTOR_SIZE,
+                     DIV_ROUND_UP (offset + size, DISK_SECTOR_SIZE),
+                     offset, offset + size);
+      if (offset + size > old_length)
+        inode->data.length = offset + size;
+    }
 
+  while (size > 0) 
+    {
       /* Sector to write, starting byte offset within sector. */
       disk_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % DISK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = length - offset;
-      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0) {
-        if (size > 0) {
-          off_t left = offset + size - length;
-          off_t slack = DISK_SECTOR_SIZE - length % DISK_SECTOR_SIZE;
-          if (slack != DISK_SECTOR_SIZE) {
-            off_t new_length = length + ((left >= slack) ? slack : left);
-            cache_write(inode->sector,
-                        &new_length,
-                        offsetof(struct inode_disk, length),
-                        sizeof(off_t));
-          } else {
-            while (left > 0) {
-              off_t incr = (left >= DISK_SECTOR_SIZE) ? DISK_SECTOR_SIZE : left;
-              if (!extend_one_block(inode, incr))
-                return bytes_written;
-              left -= incr;
-            }
-          }
-          continue;
-        } else {
-          break;
-        }
-      }
+      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == (disk_sector_t) -1)
+        break;
 
-      cache_write(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
+      cache_write(sector_idx, buffer + bytes_written, sector_ofs, chunk_size,
+                  inode_access(inode));
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
+
+  /* Only keep the growth that was actually written. */
+  if (inode->data.length > old_length && inode->data.length > offset)
+    inode->data.length = offset > old_length ? offset : old_length;
+  if (inode->data.length != old_length || inode->extent_dirty != SIZE_MAX)
+    inode_write_back(inode);
+ done:
   if (!flag)
-    lock_release(&inode->mutex);
+    rwlock_release_write(&inode->rwlock);
 
   return bytes_written;
 }
@@ -533,13 +999,13 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
-  bool flag = lock_held_by_current_thread(&inode->mutex);
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
   if (!flag)
-    lock_acquire(&inode->mutex);
+    rwlock_acquire_write(&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   if (!flag)
-    lock_release(&inode->mutex);
+    rwlock_release_write(&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -548,14 +1014,14 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
-  bool flag = lock_held_by_current_thread(&inode->mutex);
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
   if (!flag)
-    lock_acquire(&inode->mutex);
+    rwlock_acquire_write(&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
   if (!flag)
-    lock_release(&inode->mutex);
+    rwlock_release_write(&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -563,115 +1029,210 @@ off_t
 inode_length (const struct inode *inode)
 {
   off_t length;
-  bool flag = lock_held_by_current_thread(&inode->mutex);
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
   if (!flag)
-    lock_acquire((void *) &inode->mutex);
-  cache_read(inode->sector,
-             &length,
-             offsetof(struct inode_disk, length),
-             sizeof(off_t));
+    rwlock_acquire_read((struct rwlock *) &inode->rwlock);
+  length = inode->data.length;
   if (!flag)
-    lock_release((void *) &inode->mutex);
+    rwlock_release_read((struct rwlock *) &inode->rwlock);
   return length;
 }
 
+/* Returns true if INODE's data is stored in the inode itself. */
+bool
+inode_is_inline (const struct inode *inode)
+{
+  bool is_inline;
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
+  if (!flag)
+    rwlock_acquire_read((struct rwlock *) &inode->rwlock);
+  is_inline = (inode->data.flags & INODE_INLINE) != 0;
+  if (!flag)
+    rwlock_release_read((struct rwlock *) &inode->rwlock);
+  return is_inline;
+}
+
 enum file_type inode_get_type(struct inode *inode)
 {
   enum file_type type;
-  bool flag = lock_held_by_current_thread(&inode->mutex);
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
   if (!flag)
-    lock_acquire(&inode->mutex);
-  cache_read(inode->sector,
-             &type,
-             offsetof(struct inode_disk, type),
-             sizeof(enum file_type));
+    rwlock_acquire_read(&inode->rwlock);
+  type = inode->data.type;
   if (!flag)
-    lock_release(&inode->mutex);
+    rwlock_release_read(&inode->rwlock);
   return type;
 }
 
 void inode_set_type(struct inode *inode, enum file_type type)
 {
-  bool flag = lock_held_by_current_thread(&inode->mutex);
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
   if (!flag)
-    lock_acquire(&inode->mutex);
-  cache_write(inode->sector,
-              &type,
-              offsetof(struct inode_disk, type),
-              sizeof(enum file_type));
+    rwlock_acquire_write(&inode->rwlock);
+  inode->data.type = type;
+  inode_write_back(inode);
   if (!flag)
-    lock_release(&inode->mutex);
+    rwlock_release_write(&inode->rwlock);
 }
 
 disk_sector_t inode_get_parent(struct inode *child)
 {
   disk_sector_t parent;
-  bool flag = lock_held_by_current_thread(&child->mutex);
+  bool flag = rwlock_held_by_current_thread(&child->rwlock);
   if (!flag)
-    lock_acquire(&child->mutex);
-  cache_read(child->sector,
-             &parent,
-             offsetof(struct inode_disk, parent),
-             sizeof(disk_sector_t));
+    rwlock_acquire_read(&child->rwlock);
+  parent = child->data.parent;
   if (!flag)
-    lock_release(&child->mutex);
+    rwlock_release_read(&child->rwlock);
   return parent;
 }
 
 void inode_set_parent(struct inode *child, struct inode *parent)
 {
   disk_sector_t pointer = parent->sector;
-  bool flag = lock_held_by_current_thread(&child->mutex);
+  bool flag = rwlock_held_by_current_thread(&child->rwlock);
   if (!flag)
-    lock_acquire(&child->mutex);
-  cache_write(child->sector,
-              &pointer,
-              offsetof(struct inode_disk, parent),
-              sizeof(disk_sector_t));
+    rwlock_acquire_write(&child->rwlock);
+  child->data.parent = pointer;
+  inode_write_back(child);
   if (!flag)
-    lock_release(&child->mutex);
+    rwlock_release_write(&child->rwlock);
 }
 
 bool inode_is_open(struct inode *inode)
 {
   int open_cnt;
-  bool flag = lock_held_by_current_thread(&inode->mutex);
-  if (!flag)
-    lock_acquire(&inode->mutex);
+  lock_acquire(&open_inodes_mutex);
   open_cnt = inode->open_cnt;
-  if (!flag)
-    lock_release(&inode->mutex);
+  lock_release(&open_inodes_mutex);
   return open_cnt != 1;
 }
 
+/* Returns the open or recently closed inode for SECTOR, or a null
+   pointer if there is none.  Must be called with OPEN_INODES_MUTEX
+   held. */
+static struct inode *
+inode_lookup (disk_sector_t sector)
+{
+  /* Too big for the stack, and only used under the mutex. */
+  static struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.hash_elem);
+  return e ? hash_entry (e, struct inode, hash_elem) : NULL;
+}
+
+/* Drops any recently closed inode for SECTOR, which is about to
+   be overwritten by a new inode. */
+static void
+inode_forget (disk_sector_t sector)
+{
+  struct inode *inode;
+
+  lock_acquire(&open_inodes_mutex);
+  inode = inode_lookup(sector);
+  if (inode != NULL)
+    {
+      ASSERT (inode->open_cnt == 0);
+      hash_delete (&open_inodes, &inode->hash_elem);
+      list_remove (&inode->elem);
+      closed_cnt--;
+    }
+  lock_release(&open_inodes_mutex);
+  inode_free (inode);
+}
+
+/* Frees the sectors of queued removed inodes, a batch at a
+   time. */
+static void
+reclaim_thread (void *aux UNUSED)
+{
+  struct list batch;
+
+  list_init (&batch);
+  for (;;)
+    {
+      lock_acquire (&reclaim_lock);
+      while (list_empty (&reclaim_list))
+        cond_wait (&reclaim_ready, &reclaim_lock);
+      while (!list_empty (&reclaim_list))
+        list_push_back (&batch, list_pop_front (&reclaim_list));
+      reclaim_busy = true;
+      lock_release (&reclaim_lock);
+
+      while (!list_empty (&batch))
+        {
+          struct inode *inode = list_entry (list_pop_front (&batch),
+                                            struct inode, elem);
+          inode_release (inode);
+          inode_free (inode);
+        }
+
+      lock_acquire (&reclaim_lock);
+      reclaim_busy = false;
+      if (list_empty (&reclaim_list))
+        cond_broadcast (&reclaim_idle, &reclaim_lock);
+      lock_release (&reclaim_lock);
+    }
+}
+
+/* Frees INODE's memory, if INODE is not null. */
+static void
+inode_free (struct inode *inode)
+{
+  if (inode != NULL)
+    {
+      free (inode->extents);
+      free (inode->blocks);
+      free (inode);
+    }
+}
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  struct inode *inode = hash_entry (e, struct inode, hash_elem);
+  return hash_int (inode->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  struct inode *a = hash_entry (a_, struct inode, hash_elem);
+  struct inode *b = hash_entry (b_, struct inode, hash_elem);
+  return a->sector < b->sector;
+}
+
 int inode_get_pwd_cnt(struct inode *inode)
 {
   int pwd_cnt;
-  bool flag = lock_held_by_current_thread(&inode->mutex);
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
   if (!flag)
-    lock_acquire(&inode->mutex);
+    rwlock_acquire_read(&inode->rwlock);
   pwd_cnt = inode->pwd_cnt;
   if (!flag)
-    lock_release(&inode->mutex);
+    rwlock_release_read(&inode->rwlock);
   return pwd_cnt;
 }
 
 void inode_inc_pwd_cnt(struct inode *inode)
 {
-  bool flag = lock_held_by_current_thread(&inode->mutex);
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
   if (!flag)
-    lock_acquire(&inode->mutex);
+    rwlock_acquire_write(&inode->rwlock);
   inode->pwd_cnt++;
   if (!flag)
-    lock_release(&inode->mutex);
+    rwlock_release_write(&inode->rwlock);
 }
 
 void inode_dec_pwd_cnt(struct inode *inode)
 {
-  bool flag = lock_held_by_current_thread(&inode->mutex);
+  bool flag = rwlock_held_by_current_thread(&inode->rwlock);
   if (!flag)
-    lock_acquire(&inode->mutex);
+    rwlock_acquire_write(&inode->rwlock);
   inode->pwd_cnt--;
   if (!flag)
-    lock_release(&inode->mutex);
+    rwlock_release_write(&inode->rwlock);
 }
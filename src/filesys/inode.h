@@ -8,7 +8,12 @@
 
 struct bitmap;
 
+/* Files up to this many bytes long are stored in their inodes. */
+#define INODE_INLINE_MAX 480
+
 void inode_init (void);
+void inode_done (void);
+bool inode_reclaim_wait (void);
 bool inode_create (disk_sector_t, off_t);
 struct inode *inode_open (disk_sector_t);
 struct inode *inode_reopen (struct inode *);
@@ -17,9 +22,13 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t size, off_t offset);
+const void *inode_get_block (struct inode *, off_t offset);
+void inode_put_block (struct inode *, const void *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+bool inode_is_inline (const struct inode *);
 enum file_type inode_get_type(struct inode *inode);
 void inode_set_type(struct inode *inode, enum file_type type);
 disk_sector_t inode_get_parent(struct inode *child);
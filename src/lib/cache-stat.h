@@ -0,0 +1,42 @@
+#ifndef __LIB_CACHE_STAT_H
+#define __LIB_CACHE_STAT_H
+
+/* Buffer cache statistics, shared by the kernel and the
+   cachestat() system call. */
+
+/* The disk is split into this many equal regions for the access
+   histogram. */
+#define CACHE_STAT_REGIONS 16
+
+/* Write-behind batch size histogram buckets: 1, 2-3, 4-7, 8-15 and
+   16 or more lines. */
+#define CACHE_STAT_BATCHES 5
+
+struct cache_stat
+  {
+    unsigned size;                      /* Cache size in sectors. */
+
+    /* Demand accesses.  Metadata is inodes, extent blocks,
+       directories and the free map; data is the contents of
+       regular files. */
+    long long meta_hits;
+    long long meta_misses;
+    long long data_hits;
+    long long data_misses;
+
+    /* Read-ahead. */
+    long long read_aheads;              /* Sectors loaded speculatively. */
+    long long read_ahead_hits;          /* ...later used on demand. */
+    long long read_ahead_wasted;        /* ...evicted before any use. */
+
+    /* Eviction and write-back. */
+    long long evictions;                /* Lines reused for another sector. */
+    long long dirty_evictions;          /* ...that had to be written first. */
+    long long write_backs;              /* Dirty lines written to disk. */
+    long long dirty_ticks;              /* Total ticks lines stayed dirty. */
+    long long batches[CACHE_STAT_BATCHES]; /* Write-behind batch sizes. */
+
+    long long regions[CACHE_STAT_REGIONS]; /* Accesses per disk region. */
+  };
+
+#endif /* lib/cache-stat.h */
@@ -69,6 +69,36 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.
+   Examines a whole element at a time, so runs of bits not set to
+   VALUE are skipped ELEM_BITS at a time. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t idx = elem_idx (start);
+  elem_type bits;
+
+  if (start >= end)
+    return end;
+
+  /* Bits set in BITS are those set to VALUE, ignoring those
+     before START in the first element. */
+  bits = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+  for (;;)
+    {
+      if (bits != 0)
+        {
+          size_t bit_idx = idx * ELEM_BITS + __builtin_ctzl (bits);
+          return bit_idx < end ? bit_idx : end;
+        }
+      if (++idx * ELEM_BITS >= end)
+        return end;
+      bits = b->bits[idx] ^ flip;
+    }
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -251,16 +281,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -299,13 +324,29 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      while (i <= last) 
+        {
+          size_t bad;
+
+          /* A group can only start at a bit set to VALUE. */
+          i = find_bit (b, i, last + 1, value);
+          if (i > last)
+            break;
+
+          /* If a bit in the group is not, no group can start
+             before the bit after it. */
+          bad = find_bit (b, i, i + cnt, !value);
+          if (bad == i + cnt)
+            return i;
+          i = bad + 1;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -359,6 +400,18 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B starting at byte offset OFS to the
+   same offset in FILE.  Return true if successful, false
+   otherwise. */
+bool
+bitmap_write_at (const struct bitmap *b, struct file *file,
+                 size_t ofs, size_t size)
+{
+  ASSERT (ofs + size <= byte_cnt (b->bit_cnt));
+  return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+         == (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -33,6 +33,9 @@ enum
     /* Sound system. */
     SYS_BEEP,                   /* Beep beep. */
     SYS_PLAY,                   /* Play a sound. */
+
+    /* Buffer cache statistics. */
+    SYS_CACHESTAT,              /* Obtains buffer cache statistics. */
   };
 
 #endif /* lib/syscall-nr.h */
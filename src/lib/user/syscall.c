@@ -222,6 +222,12 @@ inumber (int fd)
   return syscall1 (SYS_INUMBER, fd);
 }
 
+void
+cachestat (struct cache_stat *st)
+{
+  syscall1 (SYS_CACHESTAT, st);
+}
+
 void beep(uint16_t *stream, unsigned length)
 {
   syscall2(SYS_BEEP, stream, length);
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stdint.h>
+#include <cache-stat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,6 +46,7 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+void cachestat (struct cache_stat *);
 
 /* Sound system. */
 void beep(uint16_t *stream, unsigned length);
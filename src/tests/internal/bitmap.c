@@ -0,0 +1,113 @@
+/* Test program for scanning in lib/kernel/bitmap.c.
+
+   Checks bitmap_scan() against the straightforward bit-by-bit
+   scan it replaced, over bitmaps filled to various ratios, and
+   reports how long each takes.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Number of bits in the bitmaps we test, about a 4 MB disk's
+   worth of sectors. */
+#define BIT_CNT 8192
+
+/* Number of scans timed for each fill ratio and group size. */
+#define SCAN_CNT 200
+
+static void fill (struct bitmap *, int percent);
+static size_t naive_scan (const struct bitmap *, size_t start, size_t cnt,
+                          bool value);
+
+/* Compares bitmap_scan() with naive_scan(). */
+void
+test (void)
+{
+  static const int percents[] = {0, 50, 75, 90, 99, 100};
+  static const size_t cnts[] = {1, 8, 64};
+  struct bitmap *b;
+  size_t p, c;
+
+  b = bitmap_create (BIT_CNT);
+  ASSERT (b != NULL);
+
+  printf ("fill  cnt  naive ticks  word ticks\n");
+  for (p = 0; p < sizeof percents / sizeof *percents; p++)
+    for (c = 0; c < sizeof cnts / sizeof *cnts; c++)
+      {
+        int64_t naive_ticks, word_ticks;
+        size_t starts[SCAN_CNT];
+        size_t i;
+
+        fill (b, percents[p]);
+        for (i = 0; i < SCAN_CNT; i++)
+          starts[i] = random_ulong () % BIT_CNT;
+
+        /* Verify that both scans agree, for either value. */
+        for (i = 0; i < SCAN_CNT; i++)
+          {
+            ASSERT (bitmap_scan (b, starts[i], cnts[c], false)
+                    == naive_scan (b, starts[i], cnts[c], false));
+            ASSERT (bitmap_scan (b, starts[i], cnts[c], true)
+                    == naive_scan (b, starts[i], cnts[c], true));
+          }
+
+        naive_ticks = timer_ticks ();
+        for (i = 0; i < SCAN_CNT; i++)
+          naive_scan (b, starts[i], cnts[c], false);
+        naive_ticks = timer_elapsed (naive_ticks);
+
+        word_ticks = timer_ticks ();
+        for (i = 0; i < SCAN_CNT; i++)
+          bitmap_scan (b, starts[i], cnts[c], false);
+        word_ticks = timer_elapsed (word_ticks);
+
+        printf ("%3d%%  %3zu  %11lld  %10lld\n",
+                percents[p], cnts[c], naive_ticks, word_ticks);
+      }
+
+  bitmap_destroy (b);
+  printf ("bitmap: PASS\n");
+}
+
+/* Sets about PERCENT percent of the bits in B, at random. */
+static void
+fill (struct bitmap *b, int percent)
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, (int) (random_ulong () % 100) < percent);
+}
+
+/* Finds the first group of CNT consecutive bits in B at or after
+   START that are all set to VALUE, testing one bit at a time the
+   way bitmap_scan() used to.
+   If there is no such group, returns BITMAP_ERROR. */
+static size_t
+naive_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  if (cnt <= bitmap_size (b))
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i, j;
+
+      for (i = start; i <= last; i++)
+        {
+          for (j = 0; j < cnt; j++)
+            if (bitmap_test (b, i + j) != value)
+              break;
+          if (j == cnt)
+            return i;
+        }
+    }
+  return BITMAP_ERROR;
+}
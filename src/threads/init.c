@@ -31,7 +31,9 @@
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/fsutil.h"
 #endif
 #ifdef VM
@@ -258,6 +260,14 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-cache"))
+        cache_size = atoi (value);
+      else if (!strcmp (name, "-cache-policy"))
+        cache_policy_name = value;
+      else if (!strcmp (name, "-cache-flush"))
+        cache_flush_interval = atoi (value);
+      else if (!strcmp (name, "-cache-dirty"))
+        cache_dirty_ratio = atoi (value);
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -371,6 +381,12 @@ usage (void)
           "  -h                 Print this help message and power off.\n"
           "  -q                 Power off VM after actions or on panic.\n"
           "  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+          "  -cache=COUNT       Use COUNT sectors of buffer cache.\n"
+          "  -cache-policy=NAME Use cache replacement NAME (2q, clock).\n"
+          "  -cache-flush=TICKS Write dirty cache sectors back every TICKS.\n"
+          "  -cache-dirty=PCT   Write back early once PCT%% of cache is dirty.\n"
+#endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
@@ -413,6 +429,8 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   disk_print_stats ();
+  cache_print_stats ();
+  free_map_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
@@ -155,6 +155,13 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of pages in the kernel pool. */
+size_t
+palloc_kernel_page_cnt (void)
+{
+  return bitmap_size (kernel_pool.used_map);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -17,6 +17,7 @@
 #include "vm/page.h"
 #endif
 #ifdef FILESYS
+#include "filesys/cache.h"
 #include "filesys/directory.h"
 #include "filesys/inode.h"
 #endif
@@ -52,6 +53,7 @@ static bool handle_mkdir(const char *dir);
 static bool handle_readdir(int fd, char *name, const void *esp);
 static bool handle_isdir(int fd);
 static int handle_inumber(int fd);
+static void handle_cachestat(struct cache_stat *st, const void *esp);
 #endif
 #ifdef SOUND
 static void handle_beep(uint16_t *stream, unsigned length);
@@ -165,6 +167,10 @@ static void syscall_handler(struct intr_frame *f)
     read_args(f->esp, args, 1);
     f->eax = handle_inumber(args[0]);
     break;
+  case SYS_CACHESTAT:
+    read_args(f->esp, args, 1);
+    handle_cachestat((void *) args[0], f->esp);
+    break;
 #endif
 #ifdef SOUND
   case SYS_BEEP:
@@ -494,6 +500,23 @@ static int handle_inumber(int fd)
   }
   handle_exit(-1);
 }
+
+static void handle_cachestat(struct cache_stat *st, const void *esp)
+{
+  struct cache_stat tmp;
+
+#ifdef VM
+  grow_stack(st, sizeof *st, esp);
+#else
+  (void) esp;
+  if (!is_valid_vaddr(st, sizeof *st) || !is_writable_vaddr(st, sizeof *st))
+    handle_exit(-1);
+#endif
+
+  /* Copy outside the cache lock: the store may fault in a page. */
+  cache_get_stats(&tmp);
+  memcpy(st, &tmp, sizeof *st);
+}
 #endif
 
 #ifdef SOUND